@@ -0,0 +1,51 @@
+#version 330
+
+layout(location = 0) in vec4 cell;
+layout(location = 1) in vec2 valueRange;
+layout(location = 2) in vec4 cubeCorner;
+
+uniform mat4 worldToView;
+uniform vec3 gridOrigin;
+uniform vec3 gridStep;
+uniform float valueLimit;
+uniform sampler1D colorLut;
+uniform vec4 modelColor;
+uniform vec3 clipMin;
+uniform float valueLow;
+uniform float valueHigh;
+
+out vec4 gColor;
+
+void main(void)
+{
+    vec3 position = gridOrigin + cell.xyz * gridStep;
+    // Widened by a quantization step so limits equal to a value keep it
+    vec2 value = (valueRange * 2.0 - 1.0) * valueLimit +
+            vec2(-1.0, 1.0) * (2.0 * valueLimit / 65535.0);
+
+    // Bits of VoxelObject's face flags: -x, +x, -y, +y, -z, +z
+    int faces = (int(cell.w) >> 1) & 63;
+    if(any(lessThan(position, clipMin)) ||
+       value.y < valueLow || value.x > valueHigh ||
+       (faces & (1 << int(cubeCorner.w))) == 0)
+    {
+        // Filtered out or hidden face: every corner of its triangles is
+        // put behind the far plane
+        gColor = vec4(0.0);
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        return;
+    }
+
+    if((int(cell.w) & 1) != 0)
+    {
+        gColor = modelColor;
+    }
+    else
+    {
+        // Texel centers of the table cover the packed range
+        float size = float(textureSize(colorLut, 0));
+        float t = (valueRange.x + valueRange.y) * 0.5;
+        gColor = textureLod(colorLut, (t * (size - 1.0) + 0.5) / size, 0.0);
+    }
+    gl_Position = worldToView * vec4(position + cubeCorner.xyz * gridStep, 1.0);
+}
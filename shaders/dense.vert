@@ -0,0 +1,47 @@
+ #version 330
+
+// Up to 5 values of the point, the fifth one in packedExtra
+layout(location = 0) in vec4 packedValues;
+layout(location = 1) in float packedExtra;
+
+uniform mat4 worldToView;
+uniform float pointSize = 10.f;
+uniform int pointOffset;
+uniform int component;
+uniform ivec3 cellOffset;
+uniform ivec3 gridSize;
+uniform ivec3 gridStride;
+uniform vec3 gridOrigin;
+uniform vec3 gridStep;
+uniform float valueLimit;
+uniform sampler1D colorLut;
+uniform vec3 clipMin;
+uniform float valueLow;
+uniform float valueHigh;
+
+out vec4 vColor;
+
+void main(void)
+{
+    // Ids are relative to the layer of the slowest axis in cellOffset
+    ivec3 cell = (ivec3(gl_VertexID + pointOffset) / gridStride) % gridSize + cellOffset;
+    vec3 position = gridOrigin + vec3(cell) * gridStep;
+    float packedValue = component < 4 ? packedValues[component] : packedExtra;
+    // Widened by a quantization step so limits equal to a value keep it
+    float value = (packedValue * 2.0 - 1.0) * valueLimit;
+    float tolerance = 2.0 * valueLimit / 65535.0;
+
+    gl_PointSize = pointSize;
+    // Texel centers of the table cover the packed range
+    float size = float(textureSize(colorLut, 0));
+    vColor = textureLod(colorLut, (packedValue * (size - 1.0) + 0.5) / size, 0.0);
+
+    if(any(lessThan(position, clipMin)) ||
+       value + tolerance < valueLow || value - tolerance > valueHigh)
+    {
+        // Filtered out: put it behind the far plane so it is clipped
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        return;
+    }
+    gl_Position = worldToView * vec4(position, 1.0);
+}
@@ -0,0 +1,17 @@
+#version 330
+
+layout(location = 0) in vec3 corner;
+
+uniform mat4 worldToView;
+uniform vec3 gridOrigin;
+uniform vec3 gridStep;
+uniform vec4 modelColor;
+
+out vec4 gColor;
+
+void main(void)
+{
+    // Corner k lies half a step before the center of cell k
+    gColor = modelColor;
+    gl_Position = worldToView * vec4(gridOrigin + (corner - 0.5) * gridStep, 1.0);
+}
@@ -1,16 +1,51 @@
  #version 330
 
-layout(location = 0) in vec3 position;
-layout(location = 1) in vec4 color;
+layout(location = 0) in vec4 cell;
+layout(location = 1) in vec2 valueRange;
 
 uniform mat4 worldToView;
 uniform float pointSize = 10.f;
+uniform vec3 gridOrigin;
+uniform vec3 gridStep;
+uniform float valueLimit;
+uniform sampler1D colorLut;
+uniform vec4 modelColor;
+uniform vec3 clipMin;
+uniform float valueLow;
+uniform float valueHigh;
 
 out vec4 vColor;
+// Faces for voxel.geom, none if filtered out
+flat out int vFaces;
 
 void main(void)
 {
+    vec3 position = gridOrigin + cell.xyz * gridStep;
+    // Widened by a quantization step so limits equal to a value keep it
+    vec2 value = (valueRange * 2.0 - 1.0) * valueLimit +
+            vec2(-1.0, 1.0) * (2.0 * valueLimit / 65535.0);
+
     gl_PointSize = pointSize;
+    vFaces = (int(cell.w) >> 1) & 63;
+    if((int(cell.w) & 1) != 0)
+    {
+        vColor = modelColor;
+    }
+    else
+    {
+        // Texel centers of the table cover the packed range
+        float size = float(textureSize(colorLut, 0));
+        float t = (valueRange.x + valueRange.y) * 0.5;
+        vColor = textureLod(colorLut, (t * (size - 1.0) + 0.5) / size, 0.0);
+    }
+
+    if(any(lessThan(position, clipMin)) ||
+       value.y < valueLow || value.x > valueHigh)
+    {
+        // Filtered out: put it behind the far plane so it is clipped
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        vFaces = 0;
+        return;
+    }
     gl_Position = worldToView * vec4(position, 1.0);
-    vColor = color;
 }
@@ -0,0 +1,152 @@
+#include "BuildJournal.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <algorithm>
+
+static constexpr quint32 journalMagic = 0x524A4E4C; // "RJNL"
+static constexpr quint32 journalVersion = 1;
+
+
+BuildJournal::~BuildJournal()
+{
+    Close(false);
+}
+
+QString BuildJournal::JournalPath(const QString &resultPath)
+{
+    return resultPath + ".journal";
+}
+
+bool BuildJournal::Open(const QString &resultPath, const QByteArray &buildKey, qint64 spaceSize)
+{
+    Close(false);
+
+    QMutexLocker locker(&_mutex);
+    _spaceSize = spaceSize;
+    _done.clear();
+
+    _file.setFileName(JournalPath(resultPath));
+    bool resumed = false;
+    if(QFile::exists(resultPath) && _file.open(QIODevice::ReadOnly))
+    {
+        QDataStream stream(&_file);
+        quint32 magic = 0, version = 0;
+        QByteArray key;
+        stream >> magic >> version >> key;
+        if(magic == journalMagic && version == journalVersion && key == buildKey)
+        {
+            qint64 start, end;
+            while(!stream.atEnd())
+            {
+                stream >> start >> end;
+                if(stream.status() != QDataStream::Ok)
+                    break; // torn record from a crash
+                Insert(start, end);
+            }
+            resumed = true;
+        }
+        _file.close();
+    }
+
+    if(resumed)
+    {
+        if(!_file.open(QIODevice::WriteOnly | QIODevice::Append))
+            return false;
+    }
+    else
+    {
+        _done.clear();
+        if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        QDataStream stream(&_file);
+        stream << journalMagic << journalVersion << buildKey;
+        _file.flush();
+    }
+    return true;
+}
+
+void BuildJournal::Close(bool remove)
+{
+    QMutexLocker locker(&_mutex);
+    if(!_file.isOpen())
+        return;
+
+    if(remove)
+        _file.remove();
+    else
+        _file.close();
+}
+
+void BuildJournal::AddRange(qint64 start, qint64 end)
+{
+    QMutexLocker locker(&_mutex);
+    if(!_file.isOpen())
+        return;
+
+    Insert(start, end);
+    QDataStream stream(&_file);
+    stream << start << end;
+    _file.flush();
+}
+
+bool BuildJournal::IsDone(qint64 start, qint64 end) const
+{
+    QMutexLocker locker(&_mutex);
+    auto it = std::upper_bound(_done.begin(), _done.end(), start,
+                               [](qint64 value, const Range& range){ return value < range.first; });
+    if(it == _done.begin())
+        return false;
+    --it;
+    return it->first <= start && end <= it->second;
+}
+
+bool BuildJournal::IsComplete() const
+{
+    return GetDoneCount() >= _spaceSize;
+}
+
+qint64 BuildJournal::GetDoneCount() const
+{
+    QMutexLocker locker(&_mutex);
+    qint64 count = 0;
+    for(auto& range: _done)
+        count += range.second - range.first;
+    return count;
+}
+
+QVector<BuildJournal::Range> BuildJournal::GetMissingRanges() const
+{
+    QMutexLocker locker(&_mutex);
+    QVector<Range> missing;
+    qint64 position = 0;
+    for(auto& range: _done)
+    {
+        if(range.first > position)
+            missing.push_back({position, range.first});
+        position = range.second;
+    }
+    if(position < _spaceSize)
+        missing.push_back({position, _spaceSize});
+    return missing;
+}
+
+void BuildJournal::Insert(qint64 start, qint64 end)
+{
+    // _done stays sorted and merged
+    auto it = std::lower_bound(_done.begin(), _done.end(), Range(start, end));
+    it = _done.insert(it, {start, end});
+
+    int id = it - _done.begin();
+    if(id > 0 && _done[id-1].second >= _done[id].first)
+    {
+        _done[id-1].second = qMax(_done[id-1].second, _done[id].second);
+        _done.remove(id);
+        --id;
+    }
+    while(id+1 < _done.size() && _done[id].second >= _done[id+1].first)
+    {
+        _done[id].second = qMax(_done[id].second, _done[id+1].second);
+        _done.remove(id+1);
+    }
+}
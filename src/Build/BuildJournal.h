@@ -0,0 +1,45 @@
+#ifndef BUILDJOURNAL_H
+#define BUILDJOURNAL_H
+
+#include <QFile>
+#include <QMutex>
+#include <QVector>
+#include <QPair>
+
+
+// Sidecar file next to a .mbin/.ibin result that lists point ranges
+// already written to disk, so an interrupted build can be resumed
+class BuildJournal
+{
+public:
+    using Range = QPair<qint64, qint64>; // [first, second)
+
+    BuildJournal() = default;
+    ~BuildJournal();
+
+    static QString JournalPath(const QString& resultPath);
+
+    // Opens the journal for resultPath. Ranges recorded by a build with
+    // the same key are kept, otherwise the journal is started anew
+    bool Open(const QString& resultPath, const QByteArray& buildKey, qint64 spaceSize);
+    void Close(bool remove);
+
+    // Called by the writer threads after a range reached the file
+    void AddRange(qint64 start, qint64 end);
+
+    bool IsDone(qint64 start, qint64 end) const;
+    bool IsComplete() const;
+    qint64 GetDoneCount() const;
+    QVector<Range> GetMissingRanges() const;
+
+
+private:
+    void Insert(qint64 start, qint64 end);
+
+    QFile _file;
+    qint64 _spaceSize = 0;
+    QVector<Range> _done;
+    mutable QMutex _mutex;
+};
+
+#endif // BUILDJOURNAL_H
@@ -0,0 +1,295 @@
+#include "ResultPyramid.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QDebug>
+#include <limits>
+
+
+static constexpr quint32 pyramidMagic = 0x52505952; // "RPYR"
+static constexpr quint32 pyramidVersion = 2;
+
+// Size and modification time of the result the pyramid was built from
+static void ResultStamp(const QString& resultPath, qint64& size, qint64& modified)
+{
+    QFileInfo info(resultPath);
+    size = info.exists() ? info.size() : -1;
+    modified = info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+}
+
+
+QString ResultPyramid::PyramidPath(const QString &resultPath)
+{
+    return resultPath + ".pyr";
+}
+
+void ResultPyramid::Remove(const QString &resultPath)
+{
+    QFile::remove(PyramidPath(resultPath));
+}
+
+void ResultPyramid::Init(Kind kind, const SpaceGrid &grid)
+{
+    _kind = kind;
+    _grid = grid;
+    _levels.clear();
+
+    for(int l = 1; l < 31; ++l)
+    {
+        Level level;
+        level.level = l;
+        int maxSize = 0;
+        for(int a = 0; a < 3; ++a)
+        {
+            level.sizes[a] = (grid.GetSize(a) + (1 << l) - 1) >> l;
+            maxSize = qMax(maxSize, level.sizes[a]);
+        }
+        if(level.GetCellsCount() <= maxLevelCells)
+        {
+            if(_kind == Kind::Mimage)
+            {
+                level.cells.resize(level.GetCellsCount() * sizeof(MimageCell));
+                auto cells = reinterpret_cast<MimageCell*>(level.cells.data());
+                for(qint64 c = 0; c < level.GetCellsCount(); ++c)
+                {
+                    for(int k = 0; k < componentsCount; ++k)
+                    {
+                        cells[c].min[k] = std::numeric_limits<float>::max();
+                        cells[c].max[k] = std::numeric_limits<float>::lowest();
+                        cells[c].mean[k] = 0;
+                    }
+                }
+            }
+            else
+            {
+                level.cells.fill(AllZero, level.GetCellsCount());
+            }
+            _levels.push_front(level);
+        }
+        if(maxSize <= 8)
+            break;
+    }
+}
+
+void ResultPyramid::AddBatch(qint64 batchStart, int count)
+{
+    SpaceManager& space = SpaceManager::Self();
+    if(_kind == Kind::Mimage)
+        AccumulateMimage(batchStart, count, [&space](qint64 i){ return space.GetMimage(int(i)); });
+    else
+        AccumulateZones(batchStart, count, [&space](qint64 i){ return space.GetZone(int(i)); });
+}
+
+void ResultPyramid::AddZones(qint64 first, const char *zones, qint64 count)
+{
+    AccumulateZones(first, count, [zones](qint64 i){ return zones[i]; });
+}
+
+void ResultPyramid::AddMimage(qint64 first, const MimageData *values, qint64 count)
+{
+    AccumulateMimage(first, count, [values](qint64 i){ return values[i]; });
+}
+
+template<class Zone>
+void ResultPyramid::AccumulateZones(qint64 first, qint64 count, const Zone &zone)
+{
+    if(_levels.isEmpty())
+        return;
+
+    Level& level = _levels.back();
+    int x, y, z;
+    for(qint64 i = 0; i < count; ++i)
+    {
+        _grid.GetCell(first+i, x, y, z);
+        char& cell = level.cells.data()
+                [level.GetCellId(x >> level.level, y >> level.level, z >> level.level)];
+        cell = zone(i) == 0 ? (cell | AnyZero) : (cell & ~AllZero);
+    }
+}
+
+template<class Value>
+void ResultPyramid::AccumulateMimage(qint64 first, qint64 count, const Value &value)
+{
+    if(_levels.isEmpty())
+        return;
+
+    Level& level = _levels.back();
+    auto cells = reinterpret_cast<MimageCell*>(level.cells.data());
+    int x, y, z;
+    for(qint64 i = 0; i < count; ++i)
+    {
+        _grid.GetCell(first+i, x, y, z);
+        const MimageData mimage = value(i);
+        const float components[componentsCount] = {float(mimage.Cx), float(mimage.Cy),
+                                                    float(mimage.Cz), float(mimage.Cw),
+                                                    float(mimage.Ct)};
+        auto& cell = cells[level.GetCellId(x >> level.level, y >> level.level, z >> level.level)];
+        for(int k = 0; k < componentsCount; ++k)
+        {
+            cell.min[k] = qMin(cell.min[k], components[k]);
+            cell.max[k] = qMax(cell.max[k], components[k]);
+            cell.mean[k] += components[k];
+        }
+    }
+}
+
+bool ResultPyramid::Save(const QString &resultPath)
+{
+    Finalize();
+
+    QFile file(PyramidPath(resultPath));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug()<<"Couldn't write pyramid "<<file.fileName();
+        return false;
+    }
+
+    qint64 resultSize, resultModified;
+    ResultStamp(resultPath, resultSize, resultModified);
+
+    QDataStream stream(&file);
+    stream << pyramidMagic << pyramidVersion << resultSize << resultModified
+           << quint32(_kind) << qint32(_levels.size());
+    for(auto& level: _levels)
+    {
+        stream << qint32(level.level) << qint32(level.sizes[0])
+               << qint32(level.sizes[1]) << qint32(level.sizes[2]);
+        stream.writeRawData(level.cells.constData(), level.cells.size());
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool ResultPyramid::Load(const QString &resultPath)
+{
+    Clear();
+
+    QFile file(PyramidPath(resultPath));
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32 magic = 0, version = 0, kind = 0;
+    qint32 levelsCount = 0;
+    stream >> magic >> version;
+    if(magic != pyramidMagic || version != pyramidVersion)
+        return false;
+
+    // A pyramid left from another build of the same path isn't used
+    qint64 resultSize, resultModified, savedSize = 0, savedModified = 0;
+    ResultStamp(resultPath, resultSize, resultModified);
+    stream >> savedSize >> savedModified >> kind >> levelsCount;
+    if(savedSize != resultSize || savedModified != resultModified)
+    {
+        qDebug()<<"Pyramid "<<file.fileName()<<" doesn't match its result, ignored";
+        return false;
+    }
+
+    _kind = Kind(kind);
+    const qint64 cellSize = _kind == Kind::Mimage ? sizeof(MimageCell) : sizeof(char);
+    for(int i = 0; i < levelsCount; ++i)
+    {
+        Level level;
+        qint32 l, x, y, z;
+        stream >> l >> x >> y >> z;
+        level.level = l;
+        level.sizes[0] = x;
+        level.sizes[1] = y;
+        level.sizes[2] = z;
+        level.cells.resize(level.GetCellsCount() * cellSize);
+        if(stream.readRawData(level.cells.data(), level.cells.size()) != level.cells.size())
+        {
+            Clear();
+            return false;
+        }
+        _levels.push_back(level);
+    }
+    return true;
+}
+
+void ResultPyramid::Clear()
+{
+    _levels.clear();
+}
+
+ResultPyramid::Kind ResultPyramid::GetKind() const
+{
+    return _kind;
+}
+
+const QVector<ResultPyramid::Level> &ResultPyramid::GetLevels() const
+{
+    return _levels;
+}
+
+void ResultPyramid::Finalize()
+{
+    if(_levels.isEmpty())
+        return;
+
+    // Coarser levels are merged from the finest one, its cells are few
+    // enough for that to be cheap
+    const Level& finest = _levels.back();
+    for(int l = 0; l + 1 < _levels.size(); ++l)
+    {
+        Level& level = _levels[l];
+        const int shift = level.level - finest.level;
+        for(int z = 0; z < finest.sizes[2]; ++z)
+        {
+            for(int y = 0; y < finest.sizes[1]; ++y)
+            {
+                for(int x = 0; x < finest.sizes[0]; ++x)
+                {
+                    const qint64 from = finest.GetCellId(x, y, z);
+                    const qint64 to = level.GetCellId(x >> shift, y >> shift, z >> shift);
+                    if(_kind == Kind::Mimage)
+                    {
+                        auto& source = reinterpret_cast<const MimageCell*>(finest.cells.constData())[from];
+                        auto& cell = reinterpret_cast<MimageCell*>(level.cells.data())[to];
+                        for(int k = 0; k < componentsCount; ++k)
+                        {
+                            cell.min[k] = qMin(cell.min[k], source.min[k]);
+                            cell.max[k] = qMax(cell.max[k], source.max[k]);
+                            cell.mean[k] += source.mean[k];
+                        }
+                    }
+                    else
+                    {
+                        const char source = finest.cells[from];
+                        char& cell = level.cells.data()[to];
+                        cell = char(cell | (source & AnyZero));
+                        if(!(source & AllZero))
+                            cell = char(cell & ~AllZero);
+                    }
+                }
+            }
+        }
+    }
+
+    if(_kind != Kind::Mimage)
+        return;
+
+    // Sums become means
+    for(auto& level: _levels)
+    {
+        auto cells = reinterpret_cast<MimageCell*>(level.cells.data());
+        const int side = 1 << level.level;
+        for(int z = 0; z < level.sizes[2]; ++z)
+        {
+            const int countZ = qMin(side, _grid.GetSize(2) - z*side);
+            for(int y = 0; y < level.sizes[1]; ++y)
+            {
+                const int countY = qMin(side, _grid.GetSize(1) - y*side);
+                for(int x = 0; x < level.sizes[0]; ++x)
+                {
+                    const int countX = qMin(side, _grid.GetSize(0) - x*side);
+                    const float count = float(countX) * countY * countZ;
+                    auto& cell = cells[level.GetCellId(x, y, z)];
+                    for(int k = 0; k < componentsCount; ++k)
+                        cell.mean[k] /= count;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef RESULTPYRAMID_H
+#define RESULTPYRAMID_H
+
+#include <QVector>
+#include <QByteArray>
+
+#include "SpaceGrid.h"
+#include "Space/SpaceManager.h"
+
+
+// Downsampled copies of a build result stored next to it in <result>.pyr.
+// Level l merges 2^l points per axis into one cell; only levels small
+// enough to be drawn at once are kept. Points go into the finest level,
+// the coarser ones are merged from it when the pyramid is saved
+class ResultPyramid
+{
+public:
+    static constexpr qint64 maxLevelCells = 1 << 21;
+    static constexpr int componentsCount = 5;
+
+    enum class Kind: quint32
+    {
+        Model, Mimage
+    };
+
+    enum ZoneFlags: quint8
+    {
+        AnyZero = 1,
+        AllZero = 2
+    };
+
+    struct MimageCell
+    {
+        float min[componentsCount];
+        float max[componentsCount];
+        float mean[componentsCount];
+    };
+
+    struct Level
+    {
+        int level;
+        int sizes[3];
+        QByteArray cells;
+
+        inline qint64 GetCellsCount() const
+        {
+            return qint64(sizes[0]) * sizes[1] * sizes[2];
+        }
+
+        inline qint64 GetCellId(int x, int y, int z) const
+        {
+            return x + sizes[0]*(y + qint64(sizes[1])*z);
+        }
+    };
+
+    static QString PyramidPath(const QString& resultPath);
+    // Called when a new build of resultPath starts
+    static void Remove(const QString& resultPath);
+
+    void Init(Kind kind, const SpaceGrid& grid);
+    // Accumulates a computed batch from the SpaceManager buffer, called
+    // from the calculator thread while the batch is still there
+    void AddBatch(qint64 batchStart, int count);
+    // Same for values read back from a result file
+    void AddZones(qint64 first, const char* zones, qint64 count);
+    void AddMimage(qint64 first, const MimageData* values, qint64 count);
+    // Saved with the size and modification time of the finished result,
+    // Load rejects the pyramid when they don't match anymore
+    bool Save(const QString& resultPath);
+
+    bool Load(const QString& resultPath);
+    void Clear();
+
+    Kind GetKind() const;
+    // Coarsest level first
+    const QVector<Level>& GetLevels() const;
+
+
+private:
+    template<class Zone>
+    void AccumulateZones(qint64 first, qint64 count, const Zone& zone);
+    template<class Value>
+    void AccumulateMimage(qint64 first, qint64 count, const Value& value);
+    void Finalize();
+
+    Kind _kind = Kind::Model;
+    SpaceGrid _grid;
+    QVector<Level> _levels;
+};
+
+#endif // RESULTPYRAMID_H
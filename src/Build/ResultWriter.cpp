@@ -0,0 +1,373 @@
+#include "ResultWriter.h"
+
+#include <QDebug>
+#include <QThread>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+// No positional writes here, so the emulation below needs a single writer
+#define pwrite(fd, data, size, offset) (_lseeki64(fd, offset, SEEK_SET) < 0 ? -1 : _write(fd, data, unsigned(size)))
+#define close _close
+#else
+#include <unistd.h>
+#endif
+
+
+static bool WriteAllAt(int fd, const char* data, qint64 size, qint64 offset)
+{
+    while(size > 0)
+    {
+        auto written = pwrite(fd, data, size, offset);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static bool SyncFile(int fd)
+{
+#if defined(Q_OS_WIN)
+    return _commit(fd) == 0;
+#elif defined(Q_OS_LINUX)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+static bool Preallocate(int fd, qint64 size)
+{
+#if defined(Q_OS_LINUX)
+    return posix_fallocate(fd, 0, size) == 0;
+#elif defined(Q_OS_WIN)
+    return _chsize_s(fd, size) == 0;
+#else
+    return ftruncate(fd, size) == 0;
+#endif
+}
+
+
+ResultWriter::ResultWriter(QObject *parent):
+    QObject(parent),
+    _fd(-1),
+    _headerSize(0),
+    _queueCapacity(0),
+    _reserved(0),
+    _finishing(false),
+    _failed(false),
+    _unsyncedBytes(0),
+    _bytesWritten(0)
+{
+
+}
+
+ResultWriter::~ResultWriter()
+{
+    Abort();
+}
+
+bool ResultWriter::Open(const QString &filePath, qint64 headerSize, qint64 fileSize,
+                        bool preallocate, bool truncate, int queueSize, int workersCount)
+{
+    if(IsOpened())
+        Abort();
+
+#ifdef Q_OS_WIN
+    _fd = _open(filePath.toLocal8Bit().constData(),
+                _O_WRONLY | _O_CREAT | _O_BINARY | (truncate ? _O_TRUNC : 0),
+                _S_IREAD | _S_IWRITE);
+    workersCount = 1;
+#else
+    _fd = open(filePath.toLocal8Bit().constData(),
+               O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+#endif
+    if(_fd < 0)
+    {
+        qDebug()<<"ResultWriter: couldn't open "<<filePath;
+        return false;
+    }
+
+    if(preallocate && !Preallocate(_fd, fileSize))
+        qDebug()<<"ResultWriter: couldn't preallocate "<<fileSize<<" bytes";
+
+    if(workersCount <= 0)
+        workersCount = qBound(1, QThread::idealThreadCount()/2, 4);
+
+    _headerSize = headerSize;
+    _queueCapacity = qMax(queueSize, workersCount);
+    _finishing = false;
+    _failed = false;
+    _queue.clear();
+    _reserved = 0;
+    _unsynced.clear();
+    _unsyncedBytes = 0;
+    _bytesWritten = 0;
+
+    _timer.start();
+    for(int i = 0; i < workersCount; ++i)
+        _workers.emplace_back(&ResultWriter::WorkerLoop, this);
+    return true;
+}
+
+void ResultWriter::SetWrittenCallback(const WrittenCallback &callback)
+{
+    _writtenCallback = callback;
+}
+
+QByteArray ResultWriter::AcquireBuffer(qint64 size)
+{
+    QByteArray buffer;
+    {
+        QMutexLocker locker(&_mutex);
+        if(!_freeBuffers.isEmpty())
+            buffer = _freeBuffers.takeLast();
+    }
+    if(buffer.capacity() < size)
+        buffer.reserve(size);
+    buffer.resize(size);
+    return buffer;
+}
+
+bool ResultWriter::Reserve()
+{
+    QMutexLocker locker(&_mutex);
+    while(_queue.size() + _reserved >= _queueCapacity && !_failed)
+        _notFull.wait(&_mutex);
+    if(_failed)
+        return false;
+
+    _reserved++;
+    return true;
+}
+
+void ResultWriter::Unreserve()
+{
+    QMutexLocker locker(&_mutex);
+    if(_reserved > 0)
+        _reserved--;
+    _notFull.wakeAll();
+}
+
+void ResultWriter::Push(qint64 offset, QByteArray &&batch)
+{
+    QMutexLocker locker(&_mutex);
+    if(_reserved > 0)
+        _reserved--;
+    else
+    {
+        while(_queue.size() + _reserved >= _queueCapacity && !_failed)
+            _notFull.wait(&_mutex);
+    }
+    if(_failed)
+        return;
+
+    _queue.enqueue({offset, std::move(batch)});
+    _notEmpty.wakeOne();
+}
+
+bool ResultWriter::Finish(const QByteArray &header)
+{
+    if(!IsOpened())
+        return false;
+
+    {
+        QMutexLocker locker(&_mutex);
+        _finishing = true;
+        _notEmpty.wakeAll();
+    }
+    StopWorkers();
+
+    bool status = !_failed && Checkpoint(true);
+    if(status)
+        status = WriteAllAt(_fd, header.constData(), qMin<qint64>(header.size(), _headerSize), 0) &&
+                SyncFile(_fd);
+    if(!status)
+        qDebug()<<"ResultWriter: write error";
+
+    CloseFile();
+    return status;
+}
+
+void ResultWriter::Abort()
+{
+    if(!IsOpened())
+        return;
+
+    {
+        QMutexLocker locker(&_mutex);
+        _queue.clear();
+        _reserved = 0;
+        _unsynced.clear();
+        _unsyncedBytes = 0;
+        _failed = true;
+        _finishing = true;
+        _notEmpty.wakeAll();
+        _notFull.wakeAll();
+    }
+    StopWorkers();
+    CloseFile();
+}
+
+bool ResultWriter::IsOpened() const
+{
+    return _fd >= 0;
+}
+
+double ResultWriter::GetBandwidth() const
+{
+    qint64 elapsed = _timer.isValid() ? _timer.elapsed() : 0;
+    if(elapsed == 0)
+        return 0;
+    return _bytesWritten / (1024.0*1024.0) / (elapsed / 1000.0);
+}
+
+int ResultWriter::GetQueueDepth() const
+{
+    QMutexLocker locker(&_mutex);
+    return _queue.size();
+}
+
+int ResultWriter::GetQueueCapacity() const
+{
+    return _queueCapacity;
+}
+
+void ResultWriter::WorkerLoop()
+{
+    Staging staging;
+    forever
+    {
+        Batch batch;
+        {
+            QMutexLocker locker(&_mutex);
+            while(_queue.isEmpty() && !_finishing)
+                _notEmpty.wait(&_mutex);
+            if(_queue.isEmpty() || _failed)
+                break;
+            batch = _queue.dequeue();
+            // Reserve and Push may both be waiting
+            _notFull.wakeAll();
+        }
+
+        bool status = WriteBatch(staging, batch);
+        ReleaseBuffer(std::move(batch.data));
+
+        if(!status)
+        {
+            QMutexLocker locker(&_mutex);
+            _failed = true;
+            _notFull.wakeAll();
+            _notEmpty.wakeAll();
+            break;
+        }
+    }
+
+    if(!_failed && !FlushStaging(staging))
+        _failed = true;
+}
+
+bool ResultWriter::WriteBatch(Staging &staging, const Batch &batch)
+{
+    const qint64 size = batch.data.size();
+    const bool contiguous = staging.filling > 0 &&
+            staging.offset + staging.filling == batch.offset &&
+            staging.filling + size <= writeBlockSize;
+    if(contiguous)
+    {
+        std::memcpy(staging.data.data() + staging.filling, batch.data.constData(), size);
+        staging.filling += size;
+        return staging.filling < writeBlockSize || FlushStaging(staging);
+    }
+
+    if(!FlushStaging(staging))
+        return false;
+
+    if(size >= writeBlockSize)
+        return Write(batch.data.constData(), size, batch.offset);
+
+    if(staging.data.size() < writeBlockSize)
+        staging.data.resize(writeBlockSize);
+    std::memcpy(staging.data.data(), batch.data.constData(), size);
+    staging.offset = batch.offset;
+    staging.filling = size;
+    return true;
+}
+
+bool ResultWriter::FlushStaging(Staging &staging)
+{
+    if(staging.filling == 0)
+        return true;
+
+    if(!Write(staging.data.constData(), staging.filling, staging.offset))
+        return false;
+    staging.filling = 0;
+    return true;
+}
+
+bool ResultWriter::Write(const char *data, qint64 size, qint64 offset)
+{
+    if(!WriteAllAt(_fd, data, size, offset))
+        return false;
+    _bytesWritten += size;
+
+    {
+        QMutexLocker locker(&_mutex);
+        _unsynced.push_back({offset, size});
+        _unsyncedBytes += size;
+    }
+    return Checkpoint(false);
+}
+
+bool ResultWriter::Checkpoint(bool force)
+{
+    QVector<QPair<qint64, qint64>> ranges;
+    {
+        QMutexLocker locker(&_mutex);
+        if(!force && _unsyncedBytes < checkpointSize)
+            return true;
+        ranges.swap(_unsynced);
+        _unsyncedBytes = 0;
+    }
+    if(ranges.isEmpty())
+        return true;
+
+    // The journal may only list ranges that survive a power loss
+    if(!SyncFile(_fd))
+        return false;
+    if(_writtenCallback)
+    {
+        for(auto& range: ranges)
+            _writtenCallback(range.first, range.second);
+    }
+    return true;
+}
+
+void ResultWriter::ReleaseBuffer(QByteArray &&buffer)
+{
+    QMutexLocker locker(&_mutex);
+    if(_freeBuffers.size() < _queueCapacity)
+        _freeBuffers.push_back(std::move(buffer));
+}
+
+void ResultWriter::StopWorkers()
+{
+    for(auto& worker: _workers)
+        worker.join();
+    _workers.clear();
+}
+
+void ResultWriter::CloseFile()
+{
+    close(_fd);
+    _fd = -1;
+}
@@ -0,0 +1,118 @@
+#ifndef RESULTWRITER_H
+#define RESULTWRITER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QPair>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+
+
+class ResultWriter: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr qint64 writeBlockSize = 4*1024*1024;
+    // Written data is synced to disk after this many bytes
+    static constexpr qint64 checkpointSize = 64*1024*1024;
+
+    ResultWriter(QObject* parent = nullptr);
+    ~ResultWriter();
+
+    using WrittenCallback = std::function<void(qint64 offset, qint64 size)>;
+
+    // Opens the file and starts the writer threads. With preallocate the
+    // whole fileSize is reserved on disk in one extent, without truncate
+    // the data already in the file is kept (resumed builds)
+    bool Open(const QString& filePath, qint64 headerSize, qint64 fileSize,
+              bool preallocate = false, bool truncate = true,
+              int queueSize = 8, int workersCount = 0);
+
+    // Called from the writer threads for each written range once it's
+    // synced to disk, ranges are synced in checkpoints
+    void SetWrittenCallback(const WrittenCallback& callback);
+
+    // Returns a free buffer of at least size bytes, reusing released ones
+    QByteArray AcquireBuffer(qint64 size);
+
+    // Blocks until there is room for one more batch and keeps it for the
+    // next Push. Called by the producer thread before handing a batch
+    // over, so the thread calling Push never waits for the disk.
+    // False after a write error
+    bool Reserve();
+    // Gives back a reservation of a batch that won't be pushed
+    void Unreserve();
+
+    // Queues a batch for a positional write at offset. May be called from
+    // any thread in any order. Uses a reservation if there is one,
+    // otherwise blocks while the queue is full
+    void Push(qint64 offset, QByteArray&& batch);
+    // Returns a buffer from AcquireBuffer that won't be pushed
+    void ReleaseBuffer(QByteArray&& buffer);
+
+    // Drains the queue, writes the header at offset 0 and closes the file
+    bool Finish(const QByteArray& header);
+    void Abort();
+
+    bool IsOpened() const;
+
+    double GetBandwidth() const;
+    int GetQueueDepth() const;
+    int GetQueueCapacity() const;
+
+
+private:
+    struct Batch
+    {
+        qint64 offset;
+        QByteArray data;
+    };
+
+    // Small contiguous batches are merged here before writing
+    struct Staging
+    {
+        QByteArray data;
+        qint64 offset = 0;
+        qint64 filling = 0;
+    };
+
+    void WorkerLoop();
+    bool WriteBatch(Staging& staging, const Batch& batch);
+    bool FlushStaging(Staging& staging);
+    bool Write(const char* data, qint64 size, qint64 offset);
+    // Syncs the file and reports the ranges written before the sync.
+    // Without force it waits until checkpointSize bytes are pending
+    bool Checkpoint(bool force);
+    void StopWorkers();
+    void CloseFile();
+
+    int _fd;
+    qint64 _headerSize;
+    int _queueCapacity;
+    int _reserved;
+    bool _finishing;
+    std::atomic<bool> _failed;
+
+    mutable QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+    QQueue<Batch> _queue;
+    QVector<QByteArray> _freeBuffers;
+    std::vector<std::thread> _workers;
+    WrittenCallback _writtenCallback;
+    // Written, but not synced yet
+    QVector<QPair<qint64, qint64>> _unsynced;
+    qint64 _unsyncedBytes;
+
+    std::atomic<qint64> _bytesWritten;
+    QElapsedTimer _timer;
+};
+
+#endif // RESULTWRITER_H
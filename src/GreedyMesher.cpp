@@ -0,0 +1,195 @@
+#include "GreedyMesher.h"
+
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+// Zone cells left after clipping
+struct MeshSource
+{
+    const SpaceGrid& grid;
+    const char* zones;
+    char zone;
+    const int* clipMin;
+
+    // Cell of the level merging 2^lod cells per axis
+    inline bool IsSolid(const int cell[3], int lod) const
+    {
+        int begin[3];
+        int end[3];
+        for(int a = 0; a < 3; ++a)
+        {
+            if(cell[a] < 0)
+                return false;
+            begin[a] = qMax(cell[a] << lod, clipMin[a]);
+            end[a] = qMin((cell[a] + 1) << lod, grid.GetSize(a));
+            if(begin[a] >= end[a])
+                return false;
+        }
+
+        for(int z = begin[2]; z < end[2]; ++z)
+            for(int y = begin[1]; y < end[1]; ++y)
+                for(int x = begin[0]; x < end[0]; ++x)
+                    if(zones[grid.GetId(x, y, z)] == zone)
+                        return true;
+        return false;
+    }
+
+    // Level corners in corner coordinates of the grid
+    inline quint16 GetCorner(int corner, int axis, int lod) const
+    {
+        return quint16(qMin(corner << lod, grid.GetSize(axis)));
+    }
+};
+
+
+static void AddQuad(const MeshSource& source, int lod, int axis, int plane,
+                    int u0, int v0, int u1, int v1,
+                    QVector<VoxelMeshObject::Vertex>& vertices)
+{
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+    const int corners[4][2] = {{u0, v0}, {u1, v0}, {u1, v1}, {u0, v1}};
+    for(int id: {0, 1, 2, 0, 2, 3})
+    {
+        VoxelMeshObject::Vertex vertex;
+        vertex.corner[axis] = source.GetCorner(plane, axis, lod);
+        vertex.corner[u] = source.GetCorner(corners[id][0], u, lod);
+        vertex.corner[v] = source.GetCorner(corners[id][1], v, lod);
+        vertices.push_back(vertex);
+    }
+}
+
+static void MeshChunk(const MeshSource& source, const int chunkBegin[3], const int chunkEnd[3],
+                      int lod, QVector<VoxelMeshObject::Vertex>& vertices)
+{
+    // Cells of the level, chunk borders are multiples of the merged size
+    int begin[3];
+    int end[3];
+    for(int a = 0; a < 3; ++a)
+    {
+        begin[a] = chunkBegin[a] >> lod;
+        end[a] = (chunkEnd[a] + (1 << lod) - 1) >> lod;
+    }
+
+    std::vector<char> mask;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        const int width = end[u] - begin[u];
+        const int height = end[v] - begin[v];
+        mask.resize(width * height);
+
+        for(int side = 0; side < 2; ++side)
+        {
+            for(int slice = begin[axis]; slice < end[axis]; ++slice)
+            {
+                // Faces of the slice looking at a cell outside of the zone
+                int cell[3];
+                int next[3];
+                cell[axis] = slice;
+                for(int j = 0; j < height; ++j)
+                {
+                    for(int i = 0; i < width; ++i)
+                    {
+                        cell[u] = next[u] = begin[u] + i;
+                        cell[v] = next[v] = begin[v] + j;
+                        next[axis] = slice + (side ? 1 : -1);
+                        mask[i + j*width] = source.IsSolid(cell, lod) && !source.IsSolid(next, lod);
+                    }
+                }
+
+                // Grow each quad along u first, then along v while whole rows fit
+                for(int j = 0; j < height; ++j)
+                {
+                    for(int i = 0; i < width; )
+                    {
+                        if(!mask[i + j*width])
+                        {
+                            ++i;
+                            continue;
+                        }
+
+                        int w = 1;
+                        while(i + w < width && mask[i + w + j*width])
+                            ++w;
+                        int h = 1;
+                        bool fits = true;
+                        while(fits && j + h < height)
+                        {
+                            for(int k = 0; k < w && fits; ++k)
+                                fits = mask[i + k + (j + h)*width];
+                            if(fits)
+                                ++h;
+                        }
+
+                        for(int y = 0; y < h; ++y)
+                            std::fill_n(mask.begin() + i + (j + y)*width, w, 0);
+
+                        AddQuad(source, lod, axis, slice + side, begin[u] + i, begin[v] + j,
+                                begin[u] + i + w, begin[v] + j + h, vertices);
+                        i += w;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+QVector<GreedyMesher::Chunk> GreedyMesher::Build(const SpaceGrid &grid, const char *zones,
+                                                 char zone, const int clipMin[3],
+                                                 int threadsCount)
+{
+    static_assert(chunkSize % (1 << (VoxelMeshObject::lodsCount - 1)) == 0,
+                  "Chunks must hold whole cells of every level");
+
+    const MeshSource source{grid, zones, zone, clipMin};
+    int chunks[3];
+    for(int a = 0; a < 3; ++a)
+        chunks[a] = (grid.GetSize(a) + chunkSize - 1) / chunkSize;
+    const int chunksCount = chunks[0] * chunks[1] * chunks[2];
+
+    if(threadsCount <= 0)
+        threadsCount = qBound(1, chunksCount, QThread::idealThreadCount());
+
+    // Threads take chunks one by one until none is left
+    std::atomic<int> nextChunk(0);
+    QVector<QVector<Chunk>> parts(threadsCount);
+    auto work = [&](int part)
+    {
+        for(int id = nextChunk++; id < chunksCount; id = nextChunk++)
+        {
+            const int cell[3] = {id % chunks[0],
+                                 id / chunks[0] % chunks[1],
+                                 id / (chunks[0] * chunks[1])};
+            Chunk chunk;
+            for(int a = 0; a < 3; ++a)
+            {
+                chunk.begin[a] = cell[a] * chunkSize;
+                chunk.end[a] = qMin(grid.GetSize(a), chunk.begin[a] + chunkSize);
+            }
+            for(int lod = 0; lod < VoxelMeshObject::lodsCount; ++lod)
+                MeshChunk(source, chunk.begin, chunk.end, lod, chunk.lods[lod]);
+
+            if(!chunk.lods[0].isEmpty())
+                parts[part].push_back(chunk);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int t = 1; t < threadsCount; ++t)
+        threads.emplace_back(work, t);
+    work(0);
+    for(auto& thread: threads)
+        thread.join();
+
+    QVector<Chunk> result = parts[0];
+    for(int t = 1; t < threadsCount; ++t)
+        result.append(parts[t]);
+    return result;
+}
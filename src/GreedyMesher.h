@@ -0,0 +1,37 @@
+#ifndef GREEDYMESHER_H
+#define GREEDYMESHER_H
+
+#include <QVector>
+
+#include "SpaceGrid.h"
+#include "Gui/Opengl/VoxelMeshObject.h"
+
+
+// Outer faces of a zone merged into rectangles: every slice of the grid
+// is covered by the largest quads it allows. Chunks of the grid are
+// meshed independently, so quads don't cross chunk borders
+class GreedyMesher
+{
+public:
+    static constexpr int chunkSize = 32;
+
+    // Cells [begin, end) of the grid, the coarser levels are meshed from
+    // cells merging 2^l cells per axis, solid if any of them is
+    struct Chunk
+    {
+        int begin[3];
+        int end[3];
+        QVector<VoxelMeshObject::Vertex> lods[VoxelMeshObject::lodsCount];
+    };
+
+    // zones hold every point of the grid, cells below clipMin count as
+    // outside. Two triangles per quad, chunks without faces are skipped.
+    // Zero threadsCount picks it by size
+    static QVector<Chunk> Build(const SpaceGrid& grid, const char* zones,
+                                char zone, const int clipMin[3],
+                                int threadsCount = 0);
+};
+
+Q_DECLARE_METATYPE(GreedyMesher::Chunk)
+
+#endif // GREEDYMESHER_H
@@ -10,6 +10,7 @@
 #include <QFileDialog>
 #include <QLineEdit>
 #include <QSpinBox>
+#include <QCheckBox>
 
 BuildSettingsDialog::BuildSettingsDialog(QWidget *parent):
     QDialog(parent)
@@ -58,6 +59,10 @@ BuildSettingsDialog::BuildSettingsDialog(QWidget *parent):
     memoryLayout->addRow(memoryLabel, _memorySize);
     mainLayout->addLayout(memoryLayout);
 
+    _preallocate = new QCheckBox("Зарезервировать место на диске", this);
+    _preallocate->setChecked(true);
+    mainLayout->addWidget(_preallocate);
+
     QPushButton* okButton = new QPushButton("Готово", this);
     connect(okButton, &QPushButton::clicked, this, &QDialog::accept);
     mainLayout->addWidget(okButton, 0, Qt::AlignBottom | Qt::AlignRight);
@@ -122,3 +127,13 @@ void BuildSettingsDialog::setMemorySize(int newMemorySize)
 {
     _memorySize->setValue(newMemorySize);
 }
+
+bool BuildSettingsDialog::preallocate() const
+{
+    return _preallocate->isChecked();
+}
+
+void BuildSettingsDialog::setPreallocate(bool newPreallocate)
+{
+    _preallocate->setChecked(newPreallocate);
+}
@@ -6,6 +6,7 @@
 class QLineEdit;
 class QSpinBox;
 class QComboBox;
+class QCheckBox;
 
 
 class BuildSettingsDialog : public QDialog
@@ -29,6 +30,9 @@ public:
     QString fileName() const;
     void setFileName(const QString &newFileName);
 
+    bool preallocate() const;
+    void setPreallocate(bool newPreallocate);
+
 
 private slots:
     void BrowseFolder();
@@ -38,6 +42,7 @@ private:
     QComboBox* _computeMode;
     QSpinBox* _depth;
     QSpinBox* _memorySize;
+    QCheckBox* _preallocate;
 
     QLineEdit* _dirView;
     QLineEdit* _fileName;
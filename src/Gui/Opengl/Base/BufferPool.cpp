@@ -0,0 +1,97 @@
+#include "BufferPool.h"
+
+#include <QOpenGLContext>
+#include <QDebug>
+
+
+BufferPool &BufferPool::Self()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+QOpenGLBuffer BufferPool::Acquire(qint64 size, qint64 &capacity, bool &reused)
+{
+    capacity = 0;
+    reused = false;
+    if(size < 0 || size > maxBufferBytes)
+    {
+        qDebug()<<"BufferPool: "<<size<<" bytes don't fit in a buffer";
+        return QOpenGLBuffer();
+    }
+
+    QMutexLocker locker(&_mutex);
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if(!context)
+    {
+        qDebug()<<"BufferPool: no current context";
+        return QOpenGLBuffer();
+    }
+    auto& buffers = _buffers[context->shareGroup()];
+
+    // The smallest pooled buffer that fits without wasting too much
+    auto it = buffers.lowerBound(size);
+    if(it != buffers.end() && it.key() <= qMax<qint64>(size, 1) * maxWaste)
+    {
+        capacity = it.key();
+        QOpenGLBuffer buffer = it.value();
+        buffers.erase(it);
+        _statistics.pooledBytes -= capacity;
+        _statistics.reusedBytes += capacity;
+        _statistics.reuses++;
+        reused = true;
+        return buffer;
+    }
+
+    // Powers of two up to the limit, the limit itself above that
+    capacity = 1;
+    while(capacity < size)
+        capacity *= 2;
+    capacity = qMin(capacity, maxBufferBytes);
+
+    QOpenGLBuffer buffer;
+    buffer.create();
+    buffer.bind();
+    buffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    buffer.allocate(int(capacity));
+    buffer.release();
+    _statistics.allocations++;
+    _statistics.allocatedBytes += capacity;
+    return buffer;
+}
+
+void BufferPool::Release(QOpenGLBuffer buffer, qint64 capacity)
+{
+    if(!buffer.isCreated())
+        return;
+
+    QMutexLocker locker(&_mutex);
+    // Without a context the buffer is freed with its share group
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if(!context)
+    {
+        _statistics.allocatedBytes -= capacity;
+        return;
+    }
+
+    auto& buffers = _buffers[context->shareGroup()];
+    buffers.insert(capacity, buffer);
+    _statistics.pooledBytes += capacity;
+
+    // The biggest buffers go first, they are the least likely to fit
+    while(_statistics.pooledBytes > maxPooledBytes && !buffers.isEmpty())
+    {
+        auto last = buffers.end() - 1;
+        _statistics.pooledBytes -= last.key();
+        _statistics.allocatedBytes -= last.key();
+        _statistics.destroyed++;
+        last.value().destroy();
+        buffers.erase(last);
+    }
+}
+
+BufferPool::Statistics BufferPool::GetStatistics() const
+{
+    QMutexLocker locker(&_mutex);
+    return _statistics;
+}
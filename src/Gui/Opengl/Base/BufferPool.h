@@ -0,0 +1,60 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QHash>
+#include <QMultiMap>
+#include <QOpenGLBuffer>
+#include <QMutex>
+#include <limits>
+
+class QOpenGLContextGroup;
+
+
+// Vertex buffers released by drawable objects, handed out again when a
+// new object fits into them. New buffers are rounded up to powers of two
+// so growing objects don't reallocate at every step. Buffers are kept
+// per context share group, the current context's group is used.
+// Render threads share the pool, so it is locked
+class BufferPool
+{
+public:
+    // Released buffers beyond this are destroyed
+    static constexpr qint64 maxPooledBytes = 256ll*1024*1024;
+    // Pooled buffers bigger than this many times the request aren't used
+    static constexpr int maxWaste = 4;
+    // QOpenGLBuffer sizes are ints, bigger requests are refused
+    static constexpr qint64 maxBufferBytes = std::numeric_limits<int>::max();
+
+    struct Statistics
+    {
+        int allocations = 0;
+        int reuses = 0;
+        int destroyed = 0;
+        // Held by objects and by the pool
+        qint64 allocatedBytes = 0;
+        qint64 pooledBytes = 0;
+        // Handed out again instead of allocating
+        qint64 reusedBytes = 0;
+    };
+
+    static BufferPool& Self();
+
+    // Created buffer of at least size bytes, capacity is its real size.
+    // Draws of the previous owner may still read a reused buffer.
+    // Without a current context or above maxBufferBytes the buffer isn't
+    // created
+    QOpenGLBuffer Acquire(qint64 size, qint64& capacity, bool& reused);
+    void Release(QOpenGLBuffer buffer, qint64 capacity);
+
+    Statistics GetStatistics() const;
+
+
+private:
+    BufferPool() = default;
+
+    QHash<QOpenGLContextGroup*, QMultiMap<qint64, QOpenGLBuffer>> _buffers;
+    Statistics _statistics;
+    mutable QMutex _mutex;
+};
+
+#endif // BUFFERPOOL_H
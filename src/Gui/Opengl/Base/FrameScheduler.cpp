@@ -0,0 +1,116 @@
+#include "FrameScheduler.h"
+
+#include <QWidget>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLTimerQuery>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QtMath>
+
+
+FrameScheduler::FrameScheduler(QWidget *widget):
+    QObject(widget),
+    _widget(widget),
+    _frameTime(0),
+    _query(nullptr),
+    _queryChecked(false),
+    _queryRunning(false),
+    _queryPending(false),
+    _interactive(false),
+    _progressive(false)
+{
+    // Ticks follow the refresh rate of the display
+    qreal rate = 60;
+    if(QScreen* screen = QGuiApplication::primaryScreen())
+        rate = qMax<qreal>(1, screen->refreshRate());
+    _timer.setInterval(qMax(1, qFloor(1000 / rate)));
+    _timer.setTimerType(Qt::PreciseTimer);
+    connect(&_timer, &QTimer::timeout, this, &FrameScheduler::Tick);
+
+    _sinceFrame.start();
+}
+
+void FrameScheduler::RequestInteractive()
+{
+    _interactive = true;
+    Schedule();
+}
+
+void FrameScheduler::RequestProgressive()
+{
+    _progressive = true;
+    Schedule();
+}
+
+void FrameScheduler::FrameStarted()
+{
+    if(!_queryChecked)
+        CreateQuery();
+
+    if(_query)
+    {
+        // The previous frame's query, a new one starts once it is read
+        if(_queryPending && _query->isResultAvailable())
+        {
+            _frameTime = _query->waitForResult() / 1e6f;
+            _queryPending = false;
+        }
+        if(!_queryPending)
+        {
+            _query->begin();
+            _queryRunning = true;
+        }
+    }
+    _frameTimer.start();
+}
+
+void FrameScheduler::FrameFinished()
+{
+    if(_queryRunning)
+    {
+        _query->end();
+        _queryRunning = false;
+        _queryPending = true;
+    }
+    else if(!_query && _progressive)
+    {
+        // GL calls only queue the work, the frame costs what it takes to finish
+        QOpenGLContext::currentContext()->functions()->glFinish();
+        _frameTime = _frameTimer.nsecsElapsed() / 1e6f;
+    }
+
+    _sinceFrame.restart();
+    // Whatever was requested is on the screen now
+    _interactive = false;
+    _progressive = false;
+}
+
+void FrameScheduler::Tick()
+{
+    // Progressive frames wait until the time since the last frame is
+    // large enough for it to stay within the share
+    const float wait = _frameTime * (1.f / progressiveShare - 1.f);
+    if(_interactive || (_progressive && _sinceFrame.elapsed() >= wait))
+        _widget->update();
+
+    if(!_interactive && !_progressive)
+        _timer.stop();
+}
+
+void FrameScheduler::CreateQuery()
+{
+    _queryChecked = true;
+    _query = new QOpenGLTimerQuery(this);
+    if(!_query->create())
+    {
+        delete _query;
+        _query = nullptr;
+    }
+}
+
+void FrameScheduler::Schedule()
+{
+    if(!_timer.isActive())
+        _timer.start();
+}
@@ -0,0 +1,56 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class QWidget;
+class QOpenGLTimerQuery;
+
+
+// Turns repaint requests into at most one frame per display refresh.
+// Interactive changes are drawn on the next refresh, progressive ones
+// (new data arriving) are merged and wait while frames are expensive,
+// so they take at most progressiveShare of the time. Frame cost is the
+// GPU time from timer queries, read a frame later so nothing stalls.
+// Without them progressive frames are finished and timed on the CPU
+class FrameScheduler: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr float progressiveShare = 0.5f;
+
+    explicit FrameScheduler(QWidget* widget);
+
+    void RequestInteractive();
+    void RequestProgressive();
+
+    // Called around the widget's painting, with its context current
+    void FrameStarted();
+    void FrameFinished();
+
+
+private slots:
+    void Tick();
+
+
+private:
+    void Schedule();
+    void CreateQuery();
+
+    QWidget* _widget;
+    QTimer _timer;
+    QElapsedTimer _frameTimer;
+    QElapsedTimer _sinceFrame;
+    // Milliseconds of the last measured frame
+    float _frameTime;
+    QOpenGLTimerQuery* _query;
+    bool _queryChecked;
+    bool _queryRunning;
+    bool _queryPending;
+    bool _interactive;
+    bool _progressive;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -1,5 +1,12 @@
 #include "OpenglDrawableObject.h"
 
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
+#include <cstring>
+
+#include "BufferPool.h"
+
 
 OpenglDrawableObject::OpenglDrawableObject(ShaderProgram* shaderProgram, const VaoLayout &vaoLayout, QObject *parent):
     QObject(parent),
@@ -18,29 +25,8 @@ void OpenglDrawableObject::Create(const QVector<float>& vertices)
 {
     _shaderProgram->Create();
 
-    _verticesCount = vertices.size()*sizeof(float)/_vaoLayout.GetStride();
-    _verticesFilling = _verticesCount;
-    _vao.create();
-    _vao.bind();
-
-    _vbo.create();
-    _vbo.bind();
-    _vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    _vbo.allocate(vertices.data(), vertices.size()*sizeof(float));
-
-    auto& layout = _vaoLayout.GetLayoutItems();
-    auto* shader = _shaderProgram->GetProgram();
-
-    int offset = 0;
-    for(int i = 0; i < layout.size(); ++i)
-    {
-        shader->enableAttributeArray(i);
-        shader->setAttributeBuffer(i, layout[i].type, offset, layout[i].count, _vaoLayout.GetStride());
-        offset += layout[i].size;
-    }
-
-    _vao.release();
-    _vbo.release();
+    OpenglDrawableObject::Create(vertices.size()*sizeof(float)/_vaoLayout.GetStride());
+    AddData(vertices);
 }
 
 void OpenglDrawableObject::Destroy()
@@ -48,14 +34,27 @@ void OpenglDrawableObject::Destroy()
     if(_vao.isCreated())
     {
         _vao.destroy();
-        _vbo.destroy();
+        BufferPool::Self().Release(_vbo, _vboCapacity);
+        _vbo = QOpenGLBuffer();
+        _vboCapacity = 0;
     }
 }
 
 void OpenglDrawableObject::Clear()
 {
-    Destroy();
-    Create(_verticesCount);
+    if(!IsCreated())
+    {
+        Create(_verticesCount);
+        return;
+    }
+
+    // Orphaning: the driver hands out a new store while queued draws
+    // still read the old one, so the new vertices don't wait for them
+    _vbo.bind();
+    _vbo.allocate(int(_vboCapacity));
+    _vbo.release();
+    _syncedVertices = 0;
+    _verticesFilling = 0;
 }
 
 bool OpenglDrawableObject::IsCreated() const
@@ -65,43 +64,105 @@ bool OpenglDrawableObject::IsCreated() const
 
 void OpenglDrawableObject::AddData(const QVector<float> &vertices)
 {
-    const float _fillingSize = _verticesFilling * _vaoLayout.GetStride();
-    const float _maxSize = _verticesCount * _vaoLayout.GetStride();
-    const float _writeSize = vertices.size() * sizeof(float);
-    if(_fillingSize + _writeSize <= _maxSize)
+    AddData(vertices.data(), vertices.size() * sizeof(float));
+}
+
+void OpenglDrawableObject::AddData(const void *vertices, unsigned size)
+{
+    const unsigned count = size / _vaoLayout.GetStride();
+    if(void* data = MapVertices(count))
     {
-        _vbo.bind();
-        _vbo.write(_fillingSize, vertices.data(), _writeSize);
-        _vbo.release();
-        _verticesFilling += vertices.size() / _vaoLayout.GetWidth();
+        std::memcpy(data, vertices, count * _vaoLayout.GetStride());
+        UnmapVertices(count);
     }
 }
 
+void *OpenglDrawableObject::MapVertices(unsigned count)
+{
+    if(count == 0 || !IsCreated() || _verticesFilling + count > _verticesCount)
+        return nullptr;
+
+    // Vertices that have never been drawn don't wait for the GPU
+    const unsigned stride = _vaoLayout.GetStride();
+    QOpenGLBuffer::RangeAccessFlags access = QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidate;
+    if(_verticesFilling >= _syncedVertices)
+        access |= QOpenGLBuffer::RangeUnsynchronized;
+    _vbo.bind();
+    void* data = _vbo.mapRange(_verticesFilling * stride, count * stride, access);
+    _vbo.release();
+
+    _mapped = data != nullptr;
+    if(!_mapped)
+    {
+        _mapFallback.resize(count * stride);
+        data = _mapFallback.data();
+    }
+    return data;
+}
+
+void OpenglDrawableObject::UnmapVertices(unsigned written)
+{
+    const unsigned stride = _vaoLayout.GetStride();
+    _vbo.bind();
+    if(_mapped)
+    {
+        if(!_vbo.unmap())
+            written = 0;
+    }
+    else if(written > 0)
+    {
+        _vbo.write(_verticesFilling * stride, _mapFallback.constData(), written * stride);
+    }
+    _vbo.release();
+
+    _mapped = false;
+    _verticesFilling += written;
+}
+
 void OpenglDrawableObject::Create(unsigned verticesCount)
 {
+    Destroy();
+
     _verticesCount = verticesCount;
     _verticesFilling = 0;
+    bool reused = false;
+    _vbo = BufferPool::Self().Acquire(qint64(verticesCount) * _vaoLayout.GetStride(),
+                                      _vboCapacity, reused);
+    if(!_vbo.isCreated())
+    {
+        _verticesCount = 0;
+        return;
+    }
+    _syncedVertices = reused ? verticesCount : 0;
+
     _vao.create();
     _vao.bind();
-
-    _vbo.create();
     _vbo.bind();
-    _vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    _vbo.allocate(verticesCount * _vaoLayout.GetStride());
+    SetupAttributes();
 
+    _vao.release();
+    _vbo.release();
+}
+
+void OpenglDrawableObject::SetupAttributes(unsigned divisor, unsigned firstVertex)
+{
+    // QOpenGLShaderProgram::setAttributeBuffer always normalizes,
+    // integer attributes need the flag from the layout
+    QOpenGLFunctions* functions = QOpenGLContext::currentContext()->functions();
     auto& layout = _vaoLayout.GetLayoutItems();
-    auto shader = _shaderProgram->GetProgram();
 
-    int offset = 0;
+    quintptr offset = quintptr(firstVertex) * _vaoLayout.GetStride();
     for(int i = 0; i < layout.size(); ++i)
     {
-        shader->enableAttributeArray(i);
-        shader->setAttributeBuffer(i, layout[0].type, offset, layout[0].count, _vaoLayout.GetStride());
-        offset += layout[0].size;
+        functions->glEnableVertexAttribArray(i);
+        functions->glVertexAttribPointer(i, layout[i].count, layout[i].type,
+                                         layout[i].normalized ? GL_TRUE : GL_FALSE,
+                                         _vaoLayout.GetStride(),
+                                         reinterpret_cast<const void*>(offset));
+        if(divisor != 0)
+            QOpenGLContext::currentContext()->extraFunctions()->glVertexAttribDivisor(i, divisor);
+        offset += layout[i].size;
     }
-
-    _vao.release();
-    _vbo.release();
 }
 
 void OpenglDrawableObject::SetPrimitive(unsigned primitive)
@@ -124,13 +185,28 @@ ShaderProgram* OpenglDrawableObject::GetShaderProgram()
     return _shaderProgram;
 }
 
+void OpenglDrawableObject::SetShaderProgram(ShaderProgram *shaderProgram)
+{
+    _shaderProgram = shaderProgram;
+}
+
+QOpenGLBuffer &OpenglDrawableObject::GetVertexBuffer()
+{
+    return _vbo;
+}
+
 void OpenglDrawableObject::Render()
+{
+    DrawArrays(0, _verticesFilling);
+}
+
+void OpenglDrawableObject::DrawArrays(unsigned first, unsigned count)
 {
     if(_vao.isCreated())
     {
         _vao.bind();
 
-        glDrawArrays(_primitive, 0, _verticesFilling);
+        glDrawArrays(_primitive, first, count);
 
         _vao.release();
     }
@@ -146,6 +222,16 @@ unsigned OpenglDrawableObject::GetFillingSize() const
     return _verticesFilling * _vaoLayout.GetStride();
 }
 
+unsigned OpenglDrawableObject::GetVerticesCount() const
+{
+    return _verticesFilling;
+}
+
+unsigned OpenglDrawableObject::GetVerticesCapacity() const
+{
+    return _verticesCount;
+}
+
 unsigned OpenglDrawableObject::GetSize() const
 {
     return _verticesCount * _vaoLayout.GetStride();
@@ -28,19 +28,41 @@ public:
     bool IsCreated() const;
 
     void AddData(const QVector<float>& vertices);
+    // Raw vertices in the object's layout
+    void AddData(const void* vertices, unsigned size);
+
+    // Memory for count vertices appended to the buffer, nullptr if they
+    // don't fit. The first written vertices are added by UnmapVertices,
+    // nothing can be drawn or added in between
+    void* MapVertices(unsigned count);
+    void UnmapVertices(unsigned written);
 
     void SetPrimitive(unsigned primitive);
     void BindShader();
     void ReleaseShader();
-    void Render();
+    virtual void Render();
 
     unsigned GetLayoutSize() const;
     unsigned GetFillingSize() const;
     unsigned GetSize() const;
+    unsigned GetVerticesCount() const;
+    unsigned GetVerticesCapacity() const;
 
     ShaderProgram* GetShaderProgram();
+    void SetShaderProgram(ShaderProgram* shaderProgram);
+
+protected:
+    // Draws count vertices of the buffer starting from first
+    void DrawArrays(unsigned first, unsigned count);
+
+    QOpenGLBuffer& GetVertexBuffer();
+    // Points the layout attributes of the bound VAO at the bound buffer
+    // from vertex firstVertex, advancing per instance if divisor isn't 0
+    void SetupAttributes(unsigned divisor = 0, unsigned firstVertex = 0);
+
 
 private:
+
     unsigned _primitive;
     unsigned _verticesCount;
     unsigned _verticesFilling;
@@ -49,7 +71,16 @@ private:
 
     ShaderProgram* _shaderProgram;
     QOpenGLVertexArrayObject _vao;
+    // Taken from BufferPool, may be bigger than needed
     QOpenGLBuffer _vbo;
+    qint64 _vboCapacity = 0;
+    // Vertices before this one may still be read by queued draws,
+    // writing them waits for the GPU
+    unsigned _syncedVertices = 0;
+
+    // Used if the driver can't map the buffer
+    QByteArray _mapFallback;
+    bool _mapped = false;
 };
 
 #endif // IOPENGLDRAWABLEOBJECT_H
@@ -1,4 +1,5 @@
 #include "OpenglWidget.h"
+#include "ShaderCompiler.h"
 
 OpenglWidget::OpenglWidget(QWidget *parent):
     QGLWidget(QGLFormat(QGL::SampleBuffers), parent),
@@ -32,6 +33,8 @@ void OpenglWidget::initializeGL()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glClearColor(_clearColor.x(), _clearColor.y(), _clearColor.z(), _clearColor.w());
+
+    ShaderCompiler::Self().Start();
 }
 
 void OpenglWidget::resizeGL(int width, int height)
@@ -0,0 +1,114 @@
+#include "RenderThread.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+
+
+RenderThread::RenderThread(QObject *parent):
+    QThread(parent),
+    _context(nullptr),
+    _surface(nullptr),
+    _stop(false)
+{
+
+}
+
+RenderThread::~RenderThread()
+{
+    Stop();
+}
+
+void RenderThread::Start(QOpenGLContext *shareContext)
+{
+    Stop();
+
+    _context = new QOpenGLContext();
+    _context->setFormat(shareContext->format());
+    _context->setShareContext(shareContext);
+    if(!_context->create())
+    {
+        qDebug()<<"RenderThread: context creating error";
+        return;
+    }
+
+    // Surfaces are created on the GUI thread
+    _surface = new QOffscreenSurface();
+    _surface->setFormat(_context->format());
+    _surface->create();
+
+    _context->moveToThread(this);
+    _stop = false;
+    start();
+}
+
+void RenderThread::Stop()
+{
+    if(isRunning())
+    {
+        _stop = true;
+        _requests.release();
+        wait();
+    }
+
+    delete _context;
+    _context = nullptr;
+    delete _surface;
+    _surface = nullptr;
+}
+
+void RenderThread::RequestFrame()
+{
+    _requests.release();
+}
+
+unsigned RenderThread::TakeFrameTexture()
+{
+    _frames.Update();
+    QOpenGLFramebufferObject* frame = _frames.GetFront();
+    return frame ? frame->texture() : 0;
+}
+
+void RenderThread::run()
+{
+    _context->makeCurrent(_surface);
+    InitializeGL();
+
+    forever
+    {
+        _requests.acquire();
+        if(_stop)
+            break;
+        _requests.tryAcquire(_requests.available());
+
+        const QSize size = BeginFrame();
+        QOpenGLFramebufferObject*& frame = _frames.GetBack();
+        if(!frame || frame->size() != size)
+        {
+            delete frame;
+            frame = new QOpenGLFramebufferObject(size);
+        }
+
+        frame->bind();
+        _context->functions()->glViewport(0, 0, size.width(), size.height());
+        RenderFrame();
+        frame->release();
+
+        // The texture has to be complete before the widget samples it
+        _context->functions()->glFinish();
+        _frames.Publish();
+        emit FrameReady();
+    }
+
+    CleanupGL();
+    for(int i = 0; i < 3; ++i)
+    {
+        delete _frames.GetSlot(i);
+        _frames.GetSlot(i) = nullptr;
+    }
+    _context->doneCurrent();
+    _context->moveToThread(QCoreApplication::instance()->thread());
+}
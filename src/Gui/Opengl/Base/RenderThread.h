@@ -0,0 +1,63 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <atomic>
+
+#include "TripleBuffer.h"
+
+class QOpenGLContext;
+class QOffscreenSurface;
+class QOpenGLFramebufferObject;
+
+
+// Draws frames into framebuffers on its own thread with a context shared
+// with a widget. Finished frames are handed to the widget through a
+// TripleBuffer, the widget only draws their textures. Subclasses have to
+// call Stop in their destructors. Objects drawn here need their own VAOs
+// and mustn't be mapped by other threads while frames are drawn
+class RenderThread: public QThread
+{
+    Q_OBJECT
+public:
+    explicit RenderThread(QObject* parent = nullptr);
+    ~RenderThread();
+
+    // Called with the widget's context current
+    void Start(QOpenGLContext* shareContext);
+    void Stop();
+
+    // Requests arriving before a frame starts are merged
+    void RequestFrame();
+
+    // Widget side: takes the newest finished frame, 0 if none yet
+    unsigned TakeFrameTexture();
+
+
+signals:
+    void FrameReady();
+
+
+protected:
+    void run() override;
+
+    // Called on the render thread with its context current
+    virtual void InitializeGL() {}
+    virtual void CleanupGL() {}
+    // Takes the newest state, returns the size of the frame
+    virtual QSize BeginFrame() = 0;
+    // Draws into the bound framebuffer
+    virtual void RenderFrame() = 0;
+
+
+private:
+    QOpenGLContext* _context;
+    QOffscreenSurface* _surface;
+    QSemaphore _requests;
+    std::atomic<bool> _stop;
+
+    TripleBuffer<QOpenGLFramebufferObject*> _frames;
+};
+
+#endif // RENDERTHREAD_H
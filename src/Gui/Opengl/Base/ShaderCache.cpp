@@ -0,0 +1,188 @@
+#include "ShaderCache.h"
+
+#include <QCryptographicHash>
+#include <QOpenGLContext>
+#include <QFile>
+#include <QDebug>
+
+
+static bool ReadSource(const QString& path, const QByteArray& memory, QByteArray& source)
+{
+    if(!memory.isEmpty())
+    {
+        source = memory;
+        return true;
+    }
+    if(path.isEmpty())
+        return true;
+
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug()<<"Shader "<<path<<" read error";
+        return false;
+    }
+    source = file.readAll();
+    return true;
+}
+
+
+ShaderCache &ShaderCache::Self()
+{
+    static ShaderCache cache;
+    return cache;
+}
+
+QOpenGLShaderProgram *ShaderCache::Acquire(const ShadersList &list)
+{
+    const QOpenGLShader::ShaderType types[3] = {QOpenGLShader::Vertex,
+                                                QOpenGLShader::Fragment,
+                                                QOpenGLShader::Geometry};
+    QByteArray sources[3];
+    if(!ReadSource(list.vertexShader, list.vertexSource, sources[0]) ||
+            !ReadSource(list.fragmentShader, list.fragmentSource, sources[1]) ||
+            !ReadSource(list.geometryShader, list.geometrySource, sources[2]))
+        return nullptr;
+    const bool fromFiles = list.vertexSource.isEmpty() &&
+            list.fragmentSource.isEmpty() && list.geometrySource.isEmpty();
+
+    // Stage sizes go into the hash too, so sources can't shift between stages
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    for(const QByteArray& source: sources)
+    {
+        sha1.addData(QByteArray::number(source.size()) + ':');
+        sha1.addData(source);
+    }
+    const QByteArray hash = sha1.result();
+
+    QOpenGLContextGroup* group = QOpenGLContext::currentContext()->shareGroup();
+    {
+        QMutexLocker locker(&_mutex);
+        auto it = _programs[group].find(hash);
+        if(it != _programs[group].end())
+        {
+            it->users++;
+            return it->program;
+        }
+    }
+
+    // Compiled and linked unlocked, other views keep acquiring meanwhile
+    auto program = new QOpenGLShaderProgram();
+    QVector<QByteArray> stages;
+    bool added = true;
+    for(int i = 0; i < 3 && added; ++i)
+    {
+        if(sources[i].isEmpty() && types[i] == QOpenGLShader::Geometry)
+            continue;
+
+        if(fromFiles)
+        {
+            added = program->addCacheableShaderFromSourceCode(types[i], sources[i]);
+            continue;
+        }
+
+        QByteArray stageHash;
+        QOpenGLShader* shader = AcquireStage(group, types[i], sources[i], stageHash);
+        added = shader && program->addShader(shader);
+        if(shader)
+            stages.push_back(stageHash);
+    }
+
+    const bool linked = added && program->link();
+    if(!linked)
+        qDebug()<<"Shader program link error: "<<program->log();
+
+    QMutexLocker locker(&_mutex);
+    auto& programs = _programs[group];
+    auto it = programs.find(hash);
+    if(!linked || it != programs.end())
+    {
+        // The program linked first by another thread wins
+        for(const QByteArray& stage: stages)
+            ReleaseStage(group, stage);
+        delete program;
+        if(!linked)
+            return nullptr;
+        it->users++;
+        return it->program;
+    }
+
+    programs.insert(hash, {program, 1, stages});
+    _keys.insert(program, {group, hash});
+    return program;
+}
+
+void ShaderCache::Release(QOpenGLShaderProgram *program)
+{
+    QMutexLocker locker(&_mutex);
+    auto key = _keys.find(program);
+    if(key == _keys.end())
+        return;
+
+    QOpenGLContextGroup* group = key->group;
+    auto& programs = _programs[group];
+    auto it = programs.find(key->hash);
+    if(--it->users > 0)
+        return;
+
+    // Without a current context Qt frees the program with its share group
+    const QVector<QByteArray> stages = it->stages;
+    programs.erase(it);
+    _keys.erase(key);
+    delete program;
+
+    for(const QByteArray& stage: stages)
+        ReleaseStage(group, stage);
+}
+
+QOpenGLShader *ShaderCache::AcquireStage(QOpenGLContextGroup *group, QOpenGLShader::ShaderType type,
+                                         const QByteArray &source, QByteArray &hash)
+{
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    sha1.addData(QByteArray::number(int(type)) + ':');
+    sha1.addData(source);
+    hash = sha1.result();
+
+    {
+        QMutexLocker locker(&_mutex);
+        auto it = _stages[group].find(hash);
+        if(it != _stages[group].end())
+        {
+            it->users++;
+            return it->shader;
+        }
+    }
+
+    auto shader = new QOpenGLShader(type);
+    if(!shader->compileSourceCode(source))
+    {
+        qDebug()<<"Shader compile error: "<<shader->log();
+        delete shader;
+        return nullptr;
+    }
+
+    QMutexLocker locker(&_mutex);
+    auto& stages = _stages[group];
+    auto it = stages.find(hash);
+    if(it != stages.end())
+    {
+        // Compiled meanwhile by another thread, the first one is kept
+        delete shader;
+        it->users++;
+        return it->shader;
+    }
+    stages.insert(hash, {shader, 1});
+    return shader;
+}
+
+void ShaderCache::ReleaseStage(QOpenGLContextGroup *group, const QByteArray &hash)
+{
+    auto& stages = _stages[group];
+    auto it = stages.find(hash);
+    if(it == stages.end() || --it->users > 0)
+        return;
+
+    // Linked programs keep working after their stages are deleted
+    delete it->shader;
+    stages.erase(it);
+}
@@ -0,0 +1,69 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QOpenGLShaderProgram>
+
+#include "ShaderProgram.h"
+
+class QOpenGLContextGroup;
+
+
+// Linked programs shared by every view of the process. Programs are keyed
+// by the SHA-1 of their sources, so views asking for the same shaders get
+// the same program. Programs built from files link through Qt's program
+// binary disk cache, identical programs aren't recompiled on the next
+// start either. Programs with sources from memory are generated and
+// rarely repeat, their compiled stages are kept instead, so a new
+// fragment shader doesn't recompile the vertex one.
+// Compiling and linking run unlocked, when two threads build the same
+// program the first one inserted is kept.
+// Uniform values belong to the program, users set them before drawing
+class ShaderCache
+{
+public:
+    static ShaderCache& Self();
+
+    // Program of the current context's share group, nullptr on errors
+    QOpenGLShaderProgram* Acquire(const ShadersList& list);
+    void Release(QOpenGLShaderProgram* program);
+
+
+private:
+    ShaderCache() = default;
+
+    struct Stage
+    {
+        QOpenGLShader* shader;
+        int users;
+    };
+
+    struct Entry
+    {
+        QOpenGLShaderProgram* program;
+        int users;
+        // Stage hashes the program was linked from, empty for file programs
+        QVector<QByteArray> stages;
+    };
+
+    struct Key
+    {
+        QOpenGLContextGroup* group;
+        QByteArray hash;
+    };
+
+    // Locks only around the lookup and the insert, ReleaseStage is called
+    // with the lock held
+    QOpenGLShader* AcquireStage(QOpenGLContextGroup* group, QOpenGLShader::ShaderType type,
+                                const QByteArray& source, QByteArray& hash);
+    void ReleaseStage(QOpenGLContextGroup* group, const QByteArray& hash);
+
+    QHash<QOpenGLContextGroup*, QHash<QByteArray, Entry>> _programs;
+    QHash<QOpenGLContextGroup*, QHash<QByteArray, Stage>> _stages;
+    QHash<QOpenGLShaderProgram*, Key> _keys;
+    QMutex _mutex;
+};
+
+#endif // SHADERCACHE_H
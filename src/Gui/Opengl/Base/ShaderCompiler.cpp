@@ -0,0 +1,168 @@
+#include "ShaderCompiler.h"
+#include "ShaderCache.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOffscreenSurface>
+
+
+ShaderCompiler &ShaderCompiler::Self()
+{
+    static ShaderCompiler compiler;
+    return compiler;
+}
+
+ShaderCompiler::ShaderCompiler():
+    _context(nullptr),
+    _surface(nullptr),
+    _running(nullptr),
+    _stop(false)
+{
+
+}
+
+ShaderCompiler::~ShaderCompiler()
+{
+    Stop();
+}
+
+void ShaderCompiler::Start()
+{
+    QOpenGLContext* shareContext = QOpenGLContext::globalShareContext();
+    if(_context || !shareContext)
+        return;
+
+    _context = new QOpenGLContext();
+    _context->setFormat(shareContext->format());
+    _context->setShareContext(shareContext);
+    if(!_context->create())
+    {
+        qDebug()<<"ShaderCompiler: context creating error";
+        delete _context;
+        _context = nullptr;
+        return;
+    }
+
+    // Surfaces are created on the GUI thread
+    _surface = new QOffscreenSurface();
+    _surface->setFormat(_context->format());
+    _surface->create();
+
+    _context->moveToThread(this);
+    _stop = false;
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit,
+            this, &ShaderCompiler::Stop, Qt::UniqueConnection);
+    start(QThread::LowPriority);
+}
+
+void ShaderCompiler::Stop()
+{
+    if(isRunning())
+    {
+        {
+            QMutexLocker locker(&_mutex);
+            _stop = true;
+            _wakeUp.wakeAll();
+        }
+        wait();
+    }
+
+    delete _context;
+    _context = nullptr;
+    delete _surface;
+    _surface = nullptr;
+}
+
+void ShaderCompiler::Compile(ShaderProgram *target, const ShadersList &list,
+                             const std::function<void(bool)> &ready)
+{
+    QMutexLocker locker(&_mutex);
+    if(!isRunning())
+    {
+        // Linked right here with the caller's context
+        locker.unlock();
+        if(QOpenGLShaderProgram* program = ShaderCache::Self().Acquire(list))
+        {
+            target->SetPending(program);
+            if(ready)
+                ready();
+        }
+        return;
+    }
+
+    for(Job& job: _jobs)
+    {
+        if(job.target == target)
+        {
+            job = {target, list, ready};
+            return;
+        }
+    }
+    _jobs.push_back({target, list, ready});
+    _wakeUp.wakeAll();
+}
+
+void ShaderCompiler::Cancel(ShaderProgram *target)
+{
+    QMutexLocker locker(&_mutex);
+    for(int i = _jobs.size() - 1; i >= 0; --i)
+        if(_jobs[i].target == target)
+            _jobs.remove(i);
+    if(_running == target)
+        _running = nullptr;
+}
+
+void ShaderCompiler::run()
+{
+    _context->makeCurrent(_surface);
+
+    // Lets the driver compile on as many threads as it wants
+    typedef void (*MaxThreadsFunction)(unsigned);
+    for(const char* name: {"glMaxShaderCompilerThreadsKHR", "glMaxShaderCompilerThreadsARB"})
+    {
+        const QByteArray extension = QByteArray(name).endsWith("KHR") ?
+                    "GL_KHR_parallel_shader_compile" : "GL_ARB_parallel_shader_compile";
+        auto maxThreads = reinterpret_cast<MaxThreadsFunction>(_context->getProcAddress(name));
+        if(_context->hasExtension(extension) && maxThreads)
+        {
+            maxThreads(0xFFFFFFFF);
+            break;
+        }
+    }
+
+    forever
+    {
+        Job job;
+        {
+            QMutexLocker locker(&_mutex);
+            while(!_stop && _jobs.isEmpty())
+                _wakeUp.wait(&_mutex);
+            if(_stop)
+                break;
+            job = _jobs.takeFirst();
+            _running = job.target;
+        }
+
+        QOpenGLShaderProgram* program = ShaderCache::Self().Acquire(job.list);
+        // Other contexts may only use the program once linking is done
+        _context->functions()->glFinish();
+
+        QMutexLocker locker(&_mutex);
+        if(!_running)
+        {
+            if(program)
+                ShaderCache::Self().Release(program);
+            continue;
+        }
+        _running = nullptr;
+        if(program)
+            job.target->SetPending(program);
+        if(job.ready)
+            job.ready(program != nullptr);
+    }
+
+    _context->doneCurrent();
+    _context->moveToThread(QCoreApplication::instance()->thread());
+}
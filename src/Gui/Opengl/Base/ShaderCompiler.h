@@ -0,0 +1,64 @@
+#ifndef SHADERCOMPILER_H
+#define SHADERCOMPILER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <functional>
+
+#include "ShaderProgram.h"
+
+class QOpenGLContext;
+class QOffscreenSurface;
+
+
+// Links programs on a background thread with its own context in the
+// global share group, so compiling a generated shader doesn't stall the
+// thread drawing with the previous one. Drivers with parallel shader
+// compile are allowed to use their own threads as well
+class ShaderCompiler: public QThread
+{
+public:
+    static ShaderCompiler& Self();
+
+    // Called on the GUI thread once a view has a context, repeated
+    // calls do nothing. Stopped when the application quits
+    void Start();
+    void Stop();
+
+    // Replaces a pending request of the same target. The program from
+    // ShaderCache is handed to target->SetPending on the compiler thread,
+    // ready is called after that, or with false if linking failed
+    void Compile(ShaderProgram* target, const ShadersList& list,
+                 const std::function<void(bool)>& ready);
+    // No program is handed to target after this returns
+    void Cancel(ShaderProgram* target);
+
+
+protected:
+    void run() override;
+
+
+private:
+    ShaderCompiler();
+    ~ShaderCompiler();
+
+    struct Job
+    {
+        ShaderProgram* target = nullptr;
+        ShadersList list{"", ""};
+        std::function<void(bool)> ready;
+    };
+
+    QOpenGLContext* _context;
+    QOffscreenSurface* _surface;
+
+    QVector<Job> _jobs;
+    ShaderProgram* _running;
+    bool _stop;
+    QMutex _mutex;
+    QWaitCondition _wakeUp;
+};
+
+#endif // SHADERCOMPILER_H
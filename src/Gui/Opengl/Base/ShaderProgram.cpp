@@ -1,46 +1,37 @@
 #include "ShaderProgram.h"
+#include "ShaderCache.h"
+#include "ShaderCompiler.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
 
 
 ShaderProgram::ShaderProgram(const ShadersList &list, QObject *parent):
     QObject(parent),
     _shadersList(list),
-    _program(nullptr)
+    _program(nullptr),
+    _pending(nullptr)
 {
 
 }
 
 ShaderProgram::~ShaderProgram()
 {
+    ShaderCompiler::Self().Cancel(this);
+    if(_pending)
+        ShaderCache::Self().Release(_pending);
     if(_program)
-        delete _program;
+        ShaderCache::Self().Release(_program);
 }
 
 bool ShaderProgram::Create()
 {
-    _program = new QOpenGLShaderProgram();
-
-    // read the shader programs from the resource
-    if (!_program->addShaderFromSourceFile(QOpenGLShader::Vertex,
-                                           _shadersList.vertexShader))
-        return false;
-
-    if (!_program->addShaderFromSourceFile(QOpenGLShader::Fragment,
-                                           _shadersList.fragmentShader))
-        return false;
-
-    if(!_shadersList.geometryShader.isEmpty() &&
-            !_program->addShaderFromSourceFile(QOpenGLShader::Geometry,
-                                               _shadersList.geometryShader))
-        return false;
-
-    if (!_program->link())
-        return false;
-
-    _uniformIDs.clear();
-    for (const QString& uniformName : qAsConst(uniforms))
-        _uniformIDs.append(_program->uniformLocation(uniformName));
+    // Views with the same sources get the same linked program, the
+    // previous one is released after the lookup so it isn't relinked
+    QOpenGLShaderProgram* program = ShaderCache::Self().Acquire(_shadersList);
+    SetProgram(program);
 
-    return true;
+    return _program;
 }
 
 bool ShaderProgram::IsCreated()
@@ -50,21 +41,44 @@ bool ShaderProgram::IsCreated()
 
 bool ShaderProgram::Recreate(const ShadersList &list)
 {
-    if(_program)
-        delete _program;
-
+    MergeList(list);
+    return Create();
+}
 
-    if(!list.vertexShader.isEmpty())
-        _shadersList.vertexShader = list.vertexShader;
+void ShaderProgram::RecreateAsync(const ShadersList &list, const std::function<void(bool)> &ready)
+{
+    MergeList(list);
+    ShaderCompiler::Self().Compile(this, _shadersList, ready);
+}
 
-    if(!list.fragmentShader.isEmpty())
-        _shadersList.fragmentShader = list.fragmentShader;
+bool ShaderProgram::Update()
+{
+    QOpenGLShaderProgram* program;
+    {
+        QMutexLocker locker(&_pendingMutex);
+        program = _pending;
+        _pending = nullptr;
+    }
+    if(!program)
+        return false;
 
-    if(!list.geometryShader.isEmpty())
-        _shadersList.geometryShader = list.geometryShader;
+    SetProgram(program);
+    return true;
+}
 
+void ShaderProgram::SetPending(QOpenGLShaderProgram *program)
+{
+    QMutexLocker locker(&_pendingMutex);
+    // Superseded before it was taken
+    if(_pending)
+        ShaderCache::Self().Release(_pending);
+    _pending = program;
+}
 
-    return Create();
+void ShaderProgram::SetUniformValue(const char *name, int x, int y, int z)
+{
+    QOpenGLContext::currentContext()->functions()->glUniform3i(_program->uniformLocation(name),
+                                                               x, y, z);
 }
 
 void ShaderProgram::Bind()
@@ -81,3 +95,41 @@ QOpenGLShaderProgram *ShaderProgram::GetProgram()
 {
     return _program;
 }
+
+void ShaderProgram::MergeList(const ShadersList &list)
+{
+    // A stage given by file drops its source from memory and back
+    auto merge = [](const QString& file, const QByteArray& source,
+                    QString& currentFile, QByteArray& currentSource)
+    {
+        if(!source.isEmpty())
+        {
+            currentSource = source;
+            currentFile.clear();
+        }
+        else if(!file.isEmpty())
+        {
+            currentFile = file;
+            currentSource.clear();
+        }
+    };
+    merge(list.vertexShader, list.vertexSource,
+          _shadersList.vertexShader, _shadersList.vertexSource);
+    merge(list.fragmentShader, list.fragmentSource,
+          _shadersList.fragmentShader, _shadersList.fragmentSource);
+    merge(list.geometryShader, list.geometrySource,
+          _shadersList.geometryShader, _shadersList.geometrySource);
+}
+
+void ShaderProgram::SetProgram(QOpenGLShaderProgram *program)
+{
+    if(_program)
+        ShaderCache::Self().Release(_program);
+    _program = program;
+
+    _uniformIDs.clear();
+    if(!_program)
+        return;
+    for (const QString& uniformName : qAsConst(uniforms))
+        _uniformIDs.append(_program->uniformLocation(uniformName));
+}
@@ -3,7 +3,9 @@
 
 #include <QString>
 #include <QStringList>
+#include <QMutex>
 #include <QOpenGLShaderProgram>
+#include <functional>
 
 struct ShadersList
 {
@@ -19,6 +21,11 @@ struct ShadersList
     QString vertexShader;
     QString fragmentShader;
     QString geometryShader;
+
+    // Sources kept in memory, used instead of the files when set
+    QByteArray vertexSource;
+    QByteArray fragmentSource;
+    QByteArray geometrySource;
 };
 
 
@@ -31,9 +38,19 @@ public:
     ~ShaderProgram();
 
     bool Create();
+    // Stages not given in the list are kept
     bool Recreate(const ShadersList& list);
+    // Same as Recreate, but linked by ShaderCompiler. The current program
+    // stays in use until Update takes the new one, ready is called from
+    // the compiler thread once it's there, with false if linking failed
+    void RecreateAsync(const ShadersList& list, const std::function<void(bool)>& ready = {});
+    // Swaps in a program linked by RecreateAsync, true if it changed
+    bool Update();
     bool IsCreated();
 
+    // ShaderCompiler side
+    void SetPending(QOpenGLShaderProgram* program);
+
     void Bind();
     void Release();
 
@@ -44,13 +61,21 @@ public:
     {
         _program->setUniformValue(name, value);
     }
+    // ivec3 uniforms, QOpenGLShaderProgram only sets float vectors
+    void SetUniformValue(const char *name, int x, int y, int z);
 
 
 private:
+    void MergeList(const ShadersList& list);
+    void SetProgram(QOpenGLShaderProgram* program);
+
     QOpenGLShaderProgram* _program;
     ShadersList _shadersList;
 
     QList<int> _uniformIDs;
+
+    QOpenGLShaderProgram* _pending;
+    QMutex _pendingMutex;
 };
 
 #endif // SHADERPROGRAM_H
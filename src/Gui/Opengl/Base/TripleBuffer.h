@@ -0,0 +1,56 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+
+// Hands values from one writer thread to one reader thread without
+// locks: the writer fills the back slot, the reader uses the front one
+// and the middle one holds the newest published value
+template<class T>
+class TripleBuffer
+{
+public:
+    // Writer side
+    inline T& GetBack()
+    {
+        return _slots[_back];
+    }
+
+    inline void Publish()
+    {
+        _back = _middle.exchange(_back | freshBit) & indexMask;
+    }
+
+    // Reader side, true if a newer value has been taken
+    inline bool Update()
+    {
+        if(!(_middle.load() & freshBit))
+            return false;
+        _front = _middle.exchange(_front) & indexMask;
+        return true;
+    }
+
+    inline T& GetFront()
+    {
+        return _slots[_front];
+    }
+
+    // Every slot, only while neither side runs
+    inline T& GetSlot(int id)
+    {
+        return _slots[id];
+    }
+
+
+private:
+    static constexpr int indexMask = 3;
+    static constexpr int freshBit = 4;
+
+    T _slots[3] = {};
+    int _back = 0;
+    std::atomic<int> _middle{1};
+    int _front = 2;
+};
+
+#endif // TRIPLEBUFFER_H
@@ -3,13 +3,15 @@
 VaoLayoutItem::VaoLayoutItem():
     count(0),
     type(0),
-    size(0)
+    size(0),
+    normalized(false)
 {}
 
-VaoLayoutItem::VaoLayoutItem(unsigned count, unsigned type):
+VaoLayoutItem::VaoLayoutItem(unsigned count, unsigned type, bool normalized):
     count(count),
     type(type),
-    size(count * GetTypeSize(type))
+    size(count * GetTypeSize(type)),
+    normalized(normalized)
 {}
 
 unsigned VaoLayoutItem::GetTypeSize(unsigned type)
@@ -22,6 +24,10 @@ unsigned VaoLayoutItem::GetTypeSize(unsigned type)
         return sizeof(int);
     case GL_UNSIGNED_INT:
         return sizeof(unsigned);
+    case GL_UNSIGNED_SHORT:
+        return sizeof(unsigned short);
+    case GL_UNSIGNED_BYTE:
+        return sizeof(unsigned char);
     }
     assert(false);
     return 0;
@@ -37,25 +43,11 @@ VaoLayout::VaoLayout(const QVector<VaoLayoutItem> &items):
     }
 }
 
-void VaoLayout::Add(unsigned count, unsigned type)
+void VaoLayout::Add(unsigned count, unsigned type, bool normalized)
 {
-    unsigned size = 0;
-    switch(type)
-    {
-    case GL_UNSIGNED_INT:
-        size = sizeof(unsigned);
-        break;
-    case GL_INT:
-        size = sizeof(int);
-        break;
-    case GL_FLOAT:
-        size = sizeof(float);
-        break;
-    default:
-        qDebug()<<"VaoLayout error: Unsupported data type";
-    }
+    VaoLayoutItem item(count, type, normalized);
     _width += count;
-    _stride += count * size;
-    _layoutItems.append(VaoLayoutItem(count, type));
+    _stride += item.size;
+    _layoutItems.append(item);
 }
 
@@ -8,11 +8,14 @@
 struct VaoLayoutItem
 {
     VaoLayoutItem();
-    VaoLayoutItem(unsigned count, unsigned type);
+    // Integer types are converted to floats in the shader, to [0, 1]
+    // if normalized
+    VaoLayoutItem(unsigned count, unsigned type, bool normalized = false);
 
     unsigned count;
     unsigned type;
     unsigned size;
+    bool normalized;
 
     static unsigned GetTypeSize(unsigned type);
 };
@@ -23,7 +26,7 @@ public:
     VaoLayout() = default;
     VaoLayout(const QVector<VaoLayoutItem>& items);
 
-    void Add(unsigned count, unsigned type);
+    void Add(unsigned count, unsigned type, bool normalized = false);
 
     inline const QVector<VaoLayoutItem>& GetLayoutItems() const
     {
@@ -0,0 +1,118 @@
+#include "DenseVoxelObject.h"
+
+#include <algorithm>
+#include <limits>
+
+
+VaoLayout DenseVoxelObject::GetLayout(int components)
+{
+    // An attribute holds 4 values at most, the fifth one gets its own
+    components = qBound(1, components, maxComponents);
+    VaoLayout layout({VaoLayoutItem(qMin(components, 4), GL_UNSIGNED_SHORT, true)});
+    if(components > 4)
+        layout.Add(components - 4, GL_UNSIGNED_SHORT, true);
+    return layout;
+}
+
+DenseVoxelObject::DenseVoxelObject(ShaderProgram *shaderProgram, const VaoLayout &vaoLayout, QObject *parent):
+    OpenglDrawableObject(shaderProgram, vaoLayout, parent),
+    _components(vaoLayout.GetStride() / sizeof(quint16))
+{
+    SetPrimitive(GL_POINTS);
+}
+
+void DenseVoxelObject::Destroy()
+{
+    _ranges.clear();
+    OpenglDrawableObject::Destroy();
+}
+
+void DenseVoxelObject::Clear()
+{
+    _ranges.clear();
+    OpenglDrawableObject::Clear();
+}
+
+void DenseVoxelObject::Render()
+{
+    // Point ids pass 2^31 on deep grids, so each range is rebased to the
+    // start of its layer of the slowest axis: the layer goes in as a
+    // cell offset, gl_VertexID + pointOffset is the id inside it
+    int slowAxis = 0;
+    for(int axis = 1; axis < 3; ++axis)
+        if(_grid.GetStride(axis) > _grid.GetStride(slowAxis))
+            slowAxis = axis;
+    const qint64 layerPoints = _grid.GetStride(slowAxis);
+
+    GetShaderProgram()->SetUniformValue("component", _component);
+
+    for(const Range& range: _ranges)
+    {
+        const qint64 layer = range.firstPoint / layerPoints;
+        const qint64 pointOffset = range.firstPoint - layer*layerPoints - range.first;
+        Q_ASSERT(layerPoints <= std::numeric_limits<int>::max());
+        Q_ASSERT(pointOffset + range.first + range.count <= std::numeric_limits<int>::max());
+
+        int cellOffset[3] = {0, 0, 0};
+        cellOffset[slowAxis] = int(layer);
+        GetShaderProgram()->SetUniformValue("cellOffset", cellOffset[0],
+                                            cellOffset[1], cellOffset[2]);
+        GetShaderProgram()->SetUniformValue("pointOffset", int(pointOffset));
+        DrawArrays(range.first, range.count);
+    }
+}
+
+void DenseVoxelObject::SetGrid(const SpaceGrid &grid)
+{
+    _grid = grid;
+}
+
+const SpaceGrid &DenseVoxelObject::GetGrid() const
+{
+    return _grid;
+}
+
+int DenseVoxelObject::GetComponents() const
+{
+    return _components;
+}
+
+void DenseVoxelObject::SetComponent(int component)
+{
+    _component = qBound(0, component, _components - 1);
+}
+
+void DenseVoxelObject::AddValues(qint64 firstPoint, const QVector<quint16> &values)
+{
+    if(quint16* data = MapValues(firstPoint, values.size() / _components))
+    {
+        std::copy(values.constBegin(), values.constEnd(), data);
+        UnmapValues();
+    }
+}
+
+quint16 *DenseVoxelObject::MapValues(qint64 firstPoint, unsigned count)
+{
+    _mapped = {GetVerticesCount(), count, firstPoint};
+    return static_cast<quint16*>(MapVertices(count));
+}
+
+void DenseVoxelObject::UnmapValues()
+{
+    const unsigned first = _mapped.first;
+    const qint64 firstPoint = _mapped.firstPoint;
+    UnmapVertices(_mapped.count);
+    const unsigned count = GetVerticesCount() - first;
+    if(count == 0)
+        return;
+
+    // Batches of consecutive points extend the last range
+    if(!_ranges.isEmpty() &&
+            _ranges.last().first + _ranges.last().count == first &&
+            _ranges.last().firstPoint + _ranges.last().count == firstPoint)
+    {
+        _ranges.last().count += count;
+        return;
+    }
+    _ranges.push_back({first, count, firstPoint});
+}
@@ -0,0 +1,60 @@
+#ifndef DENSEVOXELOBJECT_H
+#define DENSEVOXELOBJECT_H
+
+#include <QVector>
+
+#include "Base/OpenglDrawableObject.h"
+#include "SpaceGrid.h"
+
+
+// Voxels of consecutive grid points stored as packed values only: the
+// shader takes the point id from gl_VertexID and finds its cell from
+// the grid strides. A point may hold several values, the drawn one is
+// picked by the component uniform
+class DenseVoxelObject: public OpenglDrawableObject
+{
+public:
+    static constexpr int maxComponents = 5;
+
+    // Up to maxComponents values per point
+    static VaoLayout GetLayout(int components = 1);
+
+    DenseVoxelObject(ShaderProgram *shaderProgram, const VaoLayout& vaoLayout, QObject *parent = nullptr);
+
+    void Destroy() override;
+    void Clear() override;
+    void Render() override;
+
+    void SetGrid(const SpaceGrid& grid);
+    const SpaceGrid& GetGrid() const;
+    int GetComponents() const;
+    // Value of each point that is drawn, switching it uploads nothing
+    void SetComponent(int component);
+
+    // Values packed with VoxelObject::PackValue for points starting from
+    // firstPoint, GetComponents() values per point
+    void AddValues(qint64 firstPoint, const QVector<quint16>& values);
+    // Buffer memory for values of count points from firstPoint, nullptr
+    // if they don't fit. Values of a point are consecutive. Written
+    // values are added by UnmapValues
+    quint16* MapValues(qint64 firstPoint, unsigned count);
+    void UnmapValues();
+
+
+private:
+    // Buffer vertices [first, first+count) hold points from firstPoint
+    struct Range
+    {
+        unsigned first;
+        unsigned count;
+        qint64 firstPoint;
+    };
+
+    SpaceGrid _grid;
+    int _components;
+    int _component = 0;
+    QVector<Range> _ranges;
+    Range _mapped;
+};
+
+#endif // DENSEVOXELOBJECT_H
@@ -0,0 +1,27 @@
+#include "Frustum.h"
+
+
+Frustum::Frustum(const QMatrix4x4 &worldToClip)
+{
+    // Points inside have -w <= x, y, z <= w in clip space
+    const QVector4D w = worldToClip.row(3);
+    for(int i = 0; i < 3; ++i)
+    {
+        _planes[i*2] = w + worldToClip.row(i);
+        _planes[i*2+1] = w - worldToClip.row(i);
+    }
+}
+
+bool Frustum::Intersects(const QVector3D &min, const QVector3D &max) const
+{
+    for(const QVector4D& plane: _planes)
+    {
+        // The corner furthest along the plane normal
+        const QVector3D corner(plane.x() >= 0 ? max.x() : min.x(),
+                               plane.y() >= 0 ? max.y() : min.y(),
+                               plane.z() >= 0 ? max.z() : min.z());
+        if(QVector3D::dotProduct(plane.toVector3D(), corner) + plane.w() < 0)
+            return false;
+    }
+    return true;
+}
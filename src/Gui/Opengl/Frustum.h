@@ -0,0 +1,23 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QVector4D>
+
+
+// Planes of the view volume taken from a world to clip space matrix
+class Frustum
+{
+public:
+    explicit Frustum(const QMatrix4x4& worldToClip);
+
+    // False only if the box is surely out of view
+    bool Intersects(const QVector3D& min, const QVector3D& max) const;
+
+
+private:
+    QVector4D _planes[6];
+};
+
+#endif // FRUSTUM_H
@@ -0,0 +1,92 @@
+#include "RayMarchingRenderer.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+
+RayMarchingRenderer::RayMarchingRenderer(QObject *parent):
+    RenderThread(parent),
+    _shaderVersion(0),
+    _screenShader(nullptr),
+    _screenRect(nullptr)
+{
+
+}
+
+RayMarchingRenderer::~RayMarchingRenderer()
+{
+    Stop();
+}
+
+void RayMarchingRenderer::SetState(const State &state)
+{
+    _states.GetBack() = state;
+    _states.Publish();
+    RequestFrame();
+}
+
+void RayMarchingRenderer::InitializeGL()
+{
+    // Objects of the render thread's context, VAOs aren't shared
+    ShadersList screenShadersList(":/shaders/Test/default.vert",
+                                  ":/shaders/Test/raymarching.frag");
+    _screenShader = new ShaderProgram(screenShadersList);
+    _screenShader->uniforms = QStringList({"worldToView", "resolution", "grad_step",
+                                           "cameraPosition", "cameraRotation"});
+    VaoLayout screenLayout({VaoLayoutItem(2, GL_FLOAT)});
+    _screenRect = new OpenglDrawableObject(_screenShader, screenLayout);
+    _screenRect->SetPrimitive(GL_QUADS);
+    _screenRect->Create(QVector<float>({ 1.f,  1.f,
+                                         1.f, -1.f,
+                                        -1.f, -1.f,
+                                        -1.f,  1.f}));
+}
+
+void RayMarchingRenderer::CleanupGL()
+{
+    delete _screenRect;
+    _screenRect = nullptr;
+    delete _screenShader;
+    _screenShader = nullptr;
+}
+
+QSize RayMarchingRenderer::BeginFrame()
+{
+    if(_states.Update())
+        _state = _states.GetFront();
+
+    if(_state.shaderVersion != _shaderVersion && !_state.shaderSource.isEmpty())
+    {
+        // Frames keep the previous shader until the new one is linked
+        ShadersList list("", "");
+        list.fragmentSource = _state.shaderSource;
+        const int version = _state.shaderVersion;
+        _screenShader->RecreateAsync(list, [this, version](bool linked)
+        {
+            if(linked)
+                RequestFrame();
+            emit ShaderLinked(version, linked);
+        });
+    }
+    _shaderVersion = _state.shaderVersion;
+    _screenShader->Update();
+    return _state.renderSize;
+}
+
+void RayMarchingRenderer::RenderFrame()
+{
+    QOpenGLContext::currentContext()->functions()->glClear(GL_COLOR_BUFFER_BIT);
+
+    _screenRect->BindShader();
+    _screenShader->SetUniformValue("worldToView", _state.worldToView);
+    _screenShader->SetUniformValue("grad_step", 0.02f);
+    _screenShader->SetUniformValue("resolution", _state.renderSize);
+    _screenShader->SetUniformValue("cameraPosition", _state.cameraPosition);
+    _screenShader->SetUniformValue("cameraRotation", _state.cameraRotation);
+    _screenShader->SetUniformValue("boxMin", _state.boxMin);
+    _screenShader->SetUniformValue("boxMax", _state.boxMax);
+    for(auto it = _state.parameters.cbegin(); it != _state.parameters.cend(); ++it)
+        _screenShader->SetUniformValue(it.key().constData(), it.value());
+    _screenRect->Render();
+    _screenRect->ReleaseShader();
+}
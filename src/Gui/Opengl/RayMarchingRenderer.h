@@ -0,0 +1,65 @@
+#ifndef RAYMARCHINGRENDERER_H
+#define RAYMARCHINGRENDERER_H
+
+#include <QMatrix4x4>
+#include <QVector2D>
+#include <QVector3D>
+#include <QMap>
+
+#include "Base/RenderThread.h"
+#include "Base/OpenglDrawableObject.h"
+
+
+// Draws the ray marching shader of RayMarchingView on its own thread
+class RayMarchingRenderer: public RenderThread
+{
+    Q_OBJECT
+public:
+    struct State
+    {
+        QSize renderSize{800, 600};
+        QMatrix4x4 worldToView;
+        QVector3D cameraPosition;
+        QVector2D cameraRotation;
+        // Rays are marched only inside the model's box
+        QVector3D boxMin{-1000.f, -1000.f, -1000.f};
+        QVector3D boxMax{1000.f, 1000.f, 1000.f};
+        // Generated fragment shader, linked again when the version changes.
+        // The default one is used while it's empty
+        QByteArray shaderSource;
+        int shaderVersion = 0;
+        // Float uniforms of the generated shader, changing them doesn't
+        // relink it
+        QMap<QByteArray, float> parameters;
+    };
+
+    explicit RayMarchingRenderer(QObject* parent = nullptr);
+    ~RayMarchingRenderer();
+
+    // GUI side, a frame of the newest state is requested
+    void SetState(const State& state);
+
+
+signals:
+    // From the compiler thread, once the shader of the version is linked
+    // or has failed to
+    void ShaderLinked(int version, bool linked);
+
+
+protected:
+    void InitializeGL() override;
+    void CleanupGL() override;
+    QSize BeginFrame() override;
+    void RenderFrame() override;
+
+
+private:
+    TripleBuffer<State> _states;
+    State _state;
+    int _shaderVersion;
+
+    ShaderProgram* _screenShader;
+    OpenglDrawableObject* _screenRect;
+};
+
+#endif // RAYMARCHINGRENDERER_H
@@ -6,32 +6,23 @@
 
 RayMarchingView::RayMarchingView(QWidget *parent, QSize renderSize):
     OpenglWidget(parent),
-    _renderSize(renderSize),
-    fbo(nullptr),
-    _screenData({ 1.f,  1.f,
-                  1.f, -1.f,
-                 -1.f, -1.f,
-                 -1.f,  1.f}),
     _textureData({ 1.f,  1.f, 1.f, 1.f,
                    1.f, -1.f, 1.f, 0.f,
                   -1.f, -1.f, 0.f, 0.f,
-                  -1.f,  1.f, 0.f, 1.f})
+                  -1.f,  1.f, 0.f, 1.f}),
+    _renderer(new RayMarchingRenderer(this))
 {
     m_mouseState.pressed[Qt::RightButton] = false;
     m_mouseState.pressed[Qt::LeftButton] = false;
     m_mouseState.pressed[Qt::MiddleButton] = false;
 
-    ShadersList screenShadersList(":/shaders/Test/default.vert",
-                                ":/shaders/Test/raymarching.frag");
-    QStringList screenUniforms({"worldToView", "resolution", "grad_step",
-                              "cameraPosition", "cameraRotation"});
-    ShaderProgram* screenShader = GetShaderManager().Add("voxelShader",
-                                                         screenShadersList,
-                                                         screenUniforms);
-    VaoLayout screenLayout({VaoLayoutItem(2, GL_FLOAT)});
-    _screenRect = new OpenglDrawableObject(screenShader, screenLayout);
-    _screenRect->SetPrimitive(GL_QUADS);
-
+    _state.renderSize = renderSize;
+    connect(_renderer, &RenderThread::FrameReady, this, [this](){ update(); });
+    connect(_renderer, &RayMarchingRenderer::ShaderLinked, this, [this](int version, bool linked)
+    {
+        if(version == _state.shaderVersion)
+            emit ShaderLinked(linked);
+    });
 
     ShadersList textureShaderList(":/shaders/texture.vert",
                                  ":/shaders/texture.frag");
@@ -45,36 +36,40 @@ RayMarchingView::RayMarchingView(QWidget *parent, QSize renderSize):
 
 RayMarchingView::~RayMarchingView()
 {
-    if(fbo)
-        delete fbo;
+    _renderer->Stop();
 }
 
 void RayMarchingView::SetRenderSize(const QSize &renderSize)
 {
-    _renderSize = renderSize;
-    if(fbo)
-    {
-        delete fbo;
-        fbo = new QOpenGLFramebufferObject(_renderSize);
-    }
-    updateGL();
+    _state.renderSize = renderSize;
+    PushState();
 }
 
 void RayMarchingView::ShaderFromSource(const QString &source)
 {
-    const QString tempShaderName = ".tempFragShaderFile";
-    QFile fragFile(tempShaderName);
-    if(!fragFile.open(QIODevice::WriteOnly))
-    {
-        qDebug()<<"Shader write error";
-        return;
-    }
-    QTextStream stream(&fragFile);
-    stream << source;
-    fragFile.close();
+    // Linked in the background, the renderer switches when it's ready
+    _state.shaderSource = source.toUtf8();
+    _state.shaderVersion++;
+    PushState();
+}
+
+void RayMarchingView::SetParameters(const QMap<QByteArray, float> &parameters)
+{
+    _state.parameters = parameters;
+    PushState();
+}
 
-    if(!_screenRect->GetShaderProgram()->Recreate(ShadersList("", tempShaderName)))
-        qDebug()<<"Screen shader error";
+void RayMarchingView::SetParameter(const QByteArray &name, float value)
+{
+    _state.parameters[name] = value;
+    PushState();
+}
+
+void RayMarchingView::SetModelCube(const QVector3D &start, const QVector3D &end)
+{
+    _state.boxMin = start;
+    _state.boxMax = end;
+    PushState();
 }
 
 void RayMarchingView::SetShiftState(bool pressed)
@@ -86,10 +81,10 @@ void RayMarchingView::initializeGL()
 {
     OpenglWidget::initializeGL();
 
-    _screenRect->Create(_screenData);
     _textureRect->Create(_textureData);
 
-    fbo = new QOpenGLFramebufferObject(_renderSize);
+    _renderer->Start(context()->contextHandle());
+    PushState();
 }
 
 void RayMarchingView::resizeGL(int width, int height)
@@ -105,32 +100,27 @@ void RayMarchingView::paintGL()
 {
     OpenglWidget::paintGL();
 
-    fbo->bind();
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    constexpr float s = 3.141592/180.f;
-    QVector2D cameraRotation(m_camera.xAngle*s, -m_camera.zAngle*s);
-    QVector3D cameraPos(0, 0, -m_camera.zoom);
-
-    _screenRect->BindShader();
-    _screenRect->GetShaderProgram()->SetUniformValue("worldToView", mvpMatrix);
-    _screenRect->GetShaderProgram()->SetUniformValue("grad_step", 0.02f);
-    _screenRect->GetShaderProgram()->SetUniformValue("resolution", _renderSize);
-    _screenRect->GetShaderProgram()->SetUniformValue("cameraPosition", cameraPos);
-    _screenRect->GetShaderProgram()->SetUniformValue("cameraRotation", cameraRotation);
-    _screenRect->Render();
-    _screenRect->ReleaseShader();
-
-    fbo->release();
-
+    // The newest finished frame, the previous one until it's ready
+    const unsigned texture = _renderer->TakeFrameTexture();
+    if(texture == 0)
+        return;
 
-    glBindTexture(GL_TEXTURE_2D, fbo->takeTexture());
+    glBindTexture(GL_TEXTURE_2D, texture);
 
     _textureRect->BindShader();
     _textureRect->Render();
     _textureRect->ReleaseShader();
 }
 
+void RayMarchingView::PushState()
+{
+    constexpr float s = 3.141592/180.f;
+    _state.worldToView = mvpMatrix;
+    _state.cameraRotation = QVector2D(m_camera.xAngle*s, -m_camera.zAngle*s);
+    _state.cameraPosition = QVector3D(0, 0, -m_camera.zoom);
+    _renderer->SetState(_state);
+}
+
 void RayMarchingView::mousePressEvent(QMouseEvent *event)
 {
     m_mouseState.pos = event->pos();
@@ -153,7 +143,7 @@ void RayMarchingView::UpdateMvpMatrix()
 
     mvpMatrix = projMatrix * viewMatrix;
 
-    updateGL();
+    PushState();
 }
 
 void RayMarchingView::mouseMoveEvent(QMouseEvent *event)
@@ -1,12 +1,13 @@
 #ifndef RAY_MARCHING_VIEW_H
 #define RAY_MARCHING_VIEW_H
 
-#include <QOpenGLFramebufferObject>
-
 #include "Base/OpenglDrawableObject.h"
 #include "Base/OpenglWidget.h"
+#include "RayMarchingRenderer.h"
 
 
+// Shows frames drawn by RayMarchingRenderer, so long frames don't block
+// the GUI thread
 class RayMarchingView : public OpenglWidget
 {
     Q_OBJECT
@@ -17,9 +18,20 @@ public:
     void SetRenderSize(const QSize& renderSize);
 
     void ShaderFromSource(const QString &source);
+    // Uniforms of the shader, only a new frame is drawn on changes
+    void SetParameters(const QMap<QByteArray, float>& parameters);
+    void SetParameter(const QByteArray& name, float value);
+
+    void SetModelCube(const QVector3D& start, const QVector3D& end);
 
     void SetShiftState(bool pressed);
 
+
+signals:
+    // Link result of the latest shader from ShaderFromSource
+    void ShaderLinked(bool linked);
+
+
 protected:
     void initializeGL() override;
     void resizeGL(int width, int height) override;
@@ -34,20 +46,20 @@ protected:
 
 
 private:
-    OpenglDrawableObject* _screenRect;
+    // Hands the camera and the shader over to the renderer
+    void PushState();
+
     OpenglDrawableObject* _textureRect;
 
-    const QVector<float> _screenData;
     const QVector<float> _textureData;
 
-    QSize _renderSize;
+    RayMarchingRenderer* _renderer;
+    RayMarchingRenderer::State _state;
 
     QMatrix4x4 viewMatrix;
     QMatrix4x4 projMatrix;
     QMatrix4x4 mvpMatrix;
 
-    QOpenGLFramebufferObject* fbo;
-
     struct Camera
     {
         float zoom = -5;
@@ -1,11 +1,25 @@
 #include "SceneView.h"
 
 #include "Space/SpaceManager.h"
+#include "Space/Calculators/ISpaceCalculator.h"
+#include "GreedyMesher.h"
+#include "Base/BufferPool.h"
 #include <QMouseEvent>
+#include <QElapsedTimer>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLContext>
+#include <QHash>
+#include <QtMath>
+#include <algorithm>
 
 SceneView::SceneView(QWidget *parent):
     OpenglWidget(parent),
-    voxelObject(nullptr)
+    voxelObject(nullptr),
+    denseVoxelObject(nullptr),
+    meshBuilder(new MeshBuilder(this)),
+    frameScheduler(new FrameScheduler(this)),
+    colorLut(nullptr),
+    colorLutDirty(true)
 {
     m_mouseState.pressed[Qt::RightButton] = false;
     m_mouseState.pressed[Qt::LeftButton] = false;
@@ -23,44 +37,187 @@ SceneView::SceneView(QWidget *parent):
 
 
     ShadersList voxelShadersList(":/shaders/point.vert",
-                                 ":/shaders/point.frag");
-    VaoLayout voxelLayout = VaoLayout({VaoLayoutItem(3, GL_FLOAT),
-                                       VaoLayoutItem(4, GL_FLOAT)});
-    QStringList voxelUniforms({"worldToView", "voxSize", "useAlpha"});
+                                 ":/shaders/voxel.frag",
+                                 ":/shaders/voxel.geom");
+    VaoLayout voxelLayout = VoxelObject::GetLayout();
+    QStringList voxelUniforms({"worldToView", "voxSize", "useAlpha",
+                               "gridOrigin", "gridStep", "valueLimit",
+                               "colorLut", "modelColor",
+                               "clipMin", "valueLow", "valueHigh"});
     ShaderProgram* voxelShader = GetShaderManager().Add("voxelShader",
                                                         voxelShadersList,
                                                         voxelUniforms);
     voxelObject = new VoxelObject(voxelShader, voxelLayout, this);
+
+    // Same voxels without the geometry shader, see ChooseVoxelPath
+    ShadersList instancedShadersList(":/shaders/cube.vert",
+                                     ":/shaders/voxel.frag");
+    GetShaderManager().Add("voxelInstancedShader", instancedShadersList, voxelUniforms);
+
+    ShadersList denseShadersList(":/shaders/dense.vert",
+                                 ":/shaders/point.frag");
+    QStringList denseUniforms({"worldToView", "pointOffset", "component", "gridSize", "gridStride",
+                               "gridOrigin", "gridStep", "valueLimit", "colorLut",
+                               "clipMin", "valueLow", "valueHigh"});
+    ShaderProgram* denseShader = GetShaderManager().Add("denseVoxelShader",
+                                                        denseShadersList,
+                                                        denseUniforms);
+    denseVoxelObject = new DenseVoxelObject(denseShader, DenseVoxelObject::GetLayout(), this);
+
+    ShadersList meshShadersList(":/shaders/mesh.vert",
+                                ":/shaders/voxel.frag");
+    QStringList meshUniforms({"worldToView", "gridOrigin", "gridStep", "modelColor"});
+    GetShaderManager().Add("voxelMeshShader", meshShadersList, meshUniforms);
+    connect(meshBuilder, &MeshBuilder::Built, this, &SceneView::VoxelMeshBuilt);
 }
 
-void SceneView::AddVoxelObject(float x, float y, float z,
-                               float r, float g, float b, float a)
+SceneView::~SceneView()
 {
-    voxelObject->AddVoxel(x, y, z, r, g, b, a);
+    if(colorLut)
+    {
+        makeCurrent();
+        delete colorLut;
+        doneCurrent();
+    }
 }
 
-void SceneView::Flush()
+QVector3D SceneView::GetCameraPosition() const
+{
+    return viewMatrix.inverted().map(QVector3D(0, 0, 0));
+}
+
+float SceneView::GetProjectedSize(float worldSize, const QVector3D &at) const
+{
+    const float distance = qMax(0.001f, (GetCameraPosition() - at).length());
+    return worldSize / (2.f * distance * qTan(qDegreesToRadians(fov/2.f))) * height();
+}
+
+unsigned SceneView::GetVoxelsCount() const
+{
+    return voxelObject->GetVoxelsCount();
+}
+
+unsigned SceneView::GetVoxelsCapacity() const
+{
+    return voxelObject->GetVerticesCapacity();
+}
+
+unsigned SceneView::GetDenseVoxelsCount() const
+{
+    return denseVoxelObject->GetVerticesCount();
+}
+
+unsigned SceneView::GetDenseVoxelsCapacity() const
+{
+    return denseVoxelObject->GetVerticesCapacity();
+}
+
+void SceneView::AddVoxels(const QVector<VoxelObject::Voxel> &voxels)
+{
+    voxelObject->AddVoxels(voxels);
+}
+
+void SceneView::AddVoxels(const VoxelObject::Voxel *voxels, int count)
+{
+    voxelObject->AddVoxels(voxels, count);
+}
+
+void SceneView::AddVoxels(int maxCount, const VoxelObject::Writer &writer)
+{
+    voxelObject->AddVoxels(maxCount, writer);
+}
+
+void SceneView::AddDenseVoxels(qint64 firstPoint, const QVector<quint16> &values)
 {
-    voxelObject->Flush();
+    denseVoxelObject->AddValues(firstPoint, values);
+}
 
-    updateGL();
+quint16 *SceneView::MapDenseVoxels(qint64 firstPoint, int count)
+{
+    return denseVoxelObject->MapValues(firstPoint, count);
+}
+
+void SceneView::UnmapDenseVoxels()
+{
+    denseVoxelObject->UnmapValues();
+}
+
+void SceneView::SetDenseComponent(int component)
+{
+    denseVoxelObject->SetComponent(component);
+    frameScheduler->RequestInteractive();
+}
+
+void SceneView::Flush()
+{
+    // Batches arriving while frames are drawn are merged into one
+    frameScheduler->RequestProgressive();
 }
 
 void SceneView::ClearObjects(bool soft)
 {
+    m_voxelMesh.zones.clear();
+    m_voxelMesh.built = false;
+    m_voxelMesh.chunks.clear();
+    meshBuilder->Cancel();
+    ClearVoxelMesh();
     if(!soft)
     {
         voxelObject->Destroy();
+        denseVoxelObject->Destroy();
     }
     else
     {
-        voxelObject->Clear();
+        if(voxelObject->IsCreated())
+            voxelObject->Clear();
+        if(denseVoxelObject->IsCreated())
+            denseVoxelObject->Clear();
     }
 }
 
-void SceneView::CreateVoxelObject(int count)
+void SceneView::CreateVoxelObject(qint64 count)
 {
-    voxelObject->Create(count);
+    SpaceManager& space = SpaceManager::Self();
+    if(space.WasInited())
+    {
+        const Vector3f origin = space.GetPointCoords(0);
+        const Vector3f step = space.GetPointSize();
+        SetVoxelGrid(QVector3D(origin.x, origin.y, origin.z),
+                     QVector3D(step.x, step.y, step.z));
+    }
+    voxelObject->Create(unsigned(qMin(count, BufferPool::maxBufferBytes /
+                                         VoxelObject::GetLayout().GetStride())));
+}
+
+void SceneView::CreateDenseVoxelObject(qint64 count, int components)
+{
+    // The layout is fixed per object
+    const VaoLayout layout = DenseVoxelObject::GetLayout(components);
+    if(denseVoxelObject->GetLayoutSize() != layout.GetStride())
+    {
+        ShaderProgram* denseShader = denseVoxelObject->GetShaderProgram();
+        denseVoxelObject->Destroy();
+        delete denseVoxelObject;
+        denseVoxelObject = new DenseVoxelObject(denseShader, layout, this);
+    }
+    denseVoxelObject->SetGrid(SpaceGrid::FromSpace());
+    denseVoxelObject->Create(unsigned(qMin(count, BufferPool::maxBufferBytes /
+                                              layout.GetStride())));
+}
+
+void SceneView::SetVoxelMesh(const SpaceGrid &grid, const QVector<char> &zones, char zone)
+{
+    m_voxelMesh.grid = grid;
+    m_voxelMesh.zones = zones;
+    m_voxelMesh.zone = zone;
+    m_voxelMesh.dirty = true;
+
+    frameScheduler->RequestProgressive();
+}
+
+void SceneView::SetVoxelGrid(const QVector3D &origin, const QVector3D &step)
+{
+    voxelObject->SetGrid(origin, step);
 }
 
 void SceneView::SetModelCube(const QVector3D &start, QVector3D &end)
@@ -68,11 +225,27 @@ void SceneView::SetModelCube(const QVector3D &start, QVector3D &end)
     gridObject->SetLinesSpace(start.toVector2D(), end.toVector2D());
 }
 
+void SceneView::SetVoxelFilter(const QVector3D &clipMin, float valueLow, float valueHigh)
+{
+    m_voxelFilter.clipMin = clipMin;
+    m_voxelFilter.valueLow = valueLow;
+    m_voxelFilter.valueHigh = valueHigh;
+
+    frameScheduler->RequestInteractive();
+}
+
+void SceneView::UpdateColorLut()
+{
+    colorLutDirty = true;
+    frameScheduler->RequestInteractive();
+}
+
 void SceneView::initializeGL()
 {
     OpenglWidget::initializeGL();
 
     GetShaderManager().CreateAll();
+    ChooseVoxelPath();
 
     gridObject->Create();
     wcsObject->Create();
@@ -83,40 +256,277 @@ void SceneView::resizeGL(int width, int height)
     OpenglWidget::resizeGL(width, height);
 
     projMatrix.setToIdentity();
-    projMatrix.perspective(45, width/(float)height, 0.1, 10000);
+    projMatrix.perspective(fov, width/(float)height, 0.1, 10000);
     UpdateMvpMatrix();
 }
 
 void SceneView::paintGL()
 {
+    frameScheduler->FrameStarted();
     OpenglWidget::paintGL();
 
-    Vector3f voxSize = {0.2, 0.2, 0.2};
-    if(SpaceManager::Self().WasInited())
-        voxSize = SpaceManager::Self().GetPointSize();
-
     gridObject->BindShader();
     gridObject->GetShaderProgram()->SetUniformValue("worldToView", mvpMatrix);
     gridObject->GetShaderProgram()->SetUniformValue("backColor", GetClearColor());
     gridObject->Render();
     gridObject->ReleaseShader();
 
-    if(voxelObject->IsCreated())
+    if(colorLutDirty)
     {
+        // The gradient sampled over the range of packed values
+        QVector<quint8> colors(colorLutSize * 4);
+        for(int i = 0; i < colorLutSize; ++i)
+        {
+            const float value = (2.f*i/(colorLutSize-1) - 1.f) * VoxelObject::valueLimit;
+            const Color color = ISpaceCalculator::GetMImageColor(value);
+            colors[i*4] = quint8(qBound(0.f, float(color.red), 1.f) * 255.f + 0.5f);
+            colors[i*4+1] = quint8(qBound(0.f, float(color.green), 1.f) * 255.f + 0.5f);
+            colors[i*4+2] = quint8(qBound(0.f, float(color.blue), 1.f) * 255.f + 0.5f);
+            colors[i*4+3] = quint8(qBound(0.f, float(color.alpha), 1.f) * 255.f + 0.5f);
+        }
+
+        if(!colorLut)
+        {
+            colorLut = new QOpenGLTexture(QOpenGLTexture::Target1D);
+            colorLut->setSize(colorLutSize);
+            colorLut->setFormat(QOpenGLTexture::RGBA8_UNorm);
+            colorLut->allocateStorage();
+            colorLut->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+            colorLut->setWrapMode(QOpenGLTexture::ClampToEdge);
+        }
+        colorLut->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, colors.constData());
+        colorLutDirty = false;
+    }
+
+    if(voxelObject->IsCreated() || denseVoxelObject->IsCreated())
+        colorLut->bind(0);
+
+    if(!m_voxelMesh.zones.isEmpty())
+    {
+        UpdateVoxelMesh();
+        RenderVoxelMesh();
+    }
+    else if(voxelObject->IsCreated())
+    {
+        const Color modelColor = ISpaceCalculator::GetModelColor();
+        ShaderProgram* shader = voxelObject->GetShaderProgram();
         voxelObject->BindShader();
-        voxelObject->GetShaderProgram()->SetUniformValue("worldToView", mvpMatrix);
-        voxelObject->GetShaderProgram()->SetUniformValue("voxSize", QVector3D(voxSize.x,
-                                                                              voxSize.y,
-                                                                              voxSize.z));
-        voxelObject->Render();
+        SetVoxelUniforms(shader, voxelObject->GetGridOrigin(), voxelObject->GetGridStep());
+        shader->SetUniformValue("voxSize", voxelObject->GetGridStep());
+        shader->SetUniformValue("modelColor", QVector4D(modelColor.red, modelColor.green,
+                                                        modelColor.blue, modelColor.alpha));
+        voxelObject->Render(Frustum(mvpMatrix));
         voxelObject->ReleaseShader();
     }
 
+    if(denseVoxelObject->IsCreated())
+    {
+        const SpaceGrid& grid = denseVoxelObject->GetGrid();
+        ShaderProgram* shader = denseVoxelObject->GetShaderProgram();
+        denseVoxelObject->BindShader();
+        SetVoxelUniforms(shader, grid.GetOrigin(), grid.GetStep());
+        shader->SetUniformValue("gridSize", grid.GetSize(0), grid.GetSize(1), grid.GetSize(2));
+        shader->SetUniformValue("gridStride", int(grid.GetStride(0)),
+                                int(grid.GetStride(1)), int(grid.GetStride(2)));
+        denseVoxelObject->Render();
+        denseVoxelObject->ReleaseShader();
+    }
+
+    if(voxelObject->IsCreated() || denseVoxelObject->IsCreated())
+        colorLut->release(0);
+
     wcsObject->BindShader();
     wcsObject->GetShaderProgram()->SetUniformValue("worldToView", mvpMatrix);
     wcsObject->GetShaderProgram()->SetUniformValue("backColor", GetClearColor());
     wcsObject->Render();
     wcsObject->ReleaseShader();
+    frameScheduler->FrameFinished();
+}
+
+void SceneView::SetVoxelUniforms(ShaderProgram *shader, const QVector3D &gridOrigin,
+                                 const QVector3D &gridStep)
+{
+    shader->SetUniformValue("worldToView", mvpMatrix);
+    shader->SetUniformValue("gridOrigin", gridOrigin);
+    shader->SetUniformValue("gridStep", gridStep);
+    shader->SetUniformValue("valueLimit", VoxelObject::valueLimit);
+    shader->SetUniformValue("colorLut", 0);
+    shader->SetUniformValue("clipMin", m_voxelFilter.clipMin);
+    shader->SetUniformValue("valueLow", m_voxelFilter.valueLow);
+    shader->SetUniformValue("valueHigh", m_voxelFilter.valueHigh);
+}
+
+void SceneView::ChooseVoxelPath()
+{
+    // Geometry shaders are slow on software rasterizers and many
+    // integrated drivers, instancing elsewhere: the same block of cubes
+    // is drawn both ways and the faster one is kept. Views sharing the
+    // context group share the driver, so it is measured once per group
+    static QHash<QOpenGLContextGroup*, bool> chosenPaths;
+    QOpenGLContextGroup* group = context()->contextHandle()->shareGroup();
+    ShaderProgram* geometryShader = GetShaderManager().Get("voxelShader");
+    ShaderProgram* instancedShader = GetShaderManager().Get("voxelInstancedShader");
+    bool instanced = !geometryShader->GetProgram()->isLinked();
+    if(chosenPaths.contains(group))
+    {
+        instanced = chosenPaths[group];
+    }
+    else if(!instanced && instancedShader->GetProgram()->isLinked())
+    {
+        QVector<VoxelObject::Voxel> voxels;
+        for(int z = 0; z < benchmarkSide; ++z)
+            for(int y = 0; y < benchmarkSide; ++y)
+                for(int x = 0; x < benchmarkSide; ++x)
+                    voxels.push_back(VoxelObject::Pack(x, y, z, 0, 0,
+                                                       VoxelObject::Solid | VoxelObject::AllFaces));
+
+        VoxelObject benchmark(geometryShader, VoxelObject::GetLayout());
+        benchmark.SetGrid(QVector3D(-0.5f, -0.5f, -0.5f), QVector3D(1, 1, 1) / benchmarkSide);
+        benchmark.Create(voxels.size());
+        benchmark.AddVoxels(voxels);
+
+        QOpenGLFramebufferObject target(512, 512);
+        target.bind();
+        glViewport(0, 0, target.width(), target.height());
+        const qint64 geometryTime = MeasureVoxels(&benchmark);
+        benchmark.SetShaderProgram(instancedShader);
+        benchmark.SetInstanced(true);
+        const qint64 instancedTime = MeasureVoxels(&benchmark);
+        target.release();
+        glViewport(0, 0, width(), height());
+
+        benchmark.Destroy();
+        instanced = instancedTime < geometryTime;
+
+        chosenPaths.insert(group, instanced);
+        connect(group, &QObject::destroyed, [group](){ chosenPaths.remove(group); });
+    }
+
+    voxelObject->SetShaderProgram(instanced ? instancedShader : geometryShader);
+    voxelObject->SetInstanced(instanced);
+}
+
+qint64 SceneView::MeasureVoxels(VoxelObject *voxels)
+{
+    const Color modelColor = ISpaceCalculator::GetModelColor();
+    ShaderProgram* shader = voxels->GetShaderProgram();
+    voxels->BindShader();
+    SetVoxelUniforms(shader, voxels->GetGridOrigin(), voxels->GetGridStep());
+    shader->SetUniformValue("worldToView", QMatrix4x4());
+    shader->SetUniformValue("voxSize", voxels->GetGridStep());
+    shader->SetUniformValue("modelColor", QVector4D(modelColor.red, modelColor.green,
+                                                    modelColor.blue, modelColor.alpha));
+
+    // The first frame only warms the driver up
+    glClear(GL_COLOR_BUFFER_BIT);
+    voxels->Render();
+    glFinish();
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int i = 0; i < benchmarkFrames; ++i)
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        voxels->Render();
+    }
+    glFinish();
+    const qint64 time = timer.nsecsElapsed();
+
+    voxels->ReleaseShader();
+    return time;
+}
+
+void SceneView::UpdateVoxelMesh()
+{
+    // Cells in front of clipMin are cut off like in the voxel shader
+    const SpaceGrid& grid = m_voxelMesh.grid;
+    int clipMin[3];
+    for(int a = 0; a < 3; ++a)
+    {
+        const float cell = (m_voxelFilter.clipMin[a] - grid.GetOrigin()[a]) / grid.GetStep()[a];
+        clipMin[a] = qCeil(qBound(0.f, cell, float(grid.GetSize(a))));
+    }
+
+    if(m_voxelMesh.dirty || !std::equal(clipMin, clipMin + 3, m_voxelMesh.clipMin))
+    {
+        std::copy(clipMin, clipMin + 3, m_voxelMesh.clipMin);
+        m_voxelMesh.dirty = false;
+
+        // The old chunks are drawn until the new ones are built
+        MeshBuilder::Task task;
+        task.grid = grid;
+        task.zones = m_voxelMesh.zones;
+        task.zone = m_voxelMesh.zone;
+        std::copy(clipMin, clipMin + 3, task.clipMin);
+        meshBuilder->Build(task);
+    }
+
+    if(!m_voxelMesh.built)
+        return;
+    m_voxelMesh.built = false;
+
+    ClearVoxelMesh();
+    ShaderProgram* shader = GetShaderManager().Get("voxelMeshShader");
+    const QVector3D half(0.5f, 0.5f, 0.5f);
+    for(const GreedyMesher::Chunk& chunk: m_voxelMesh.chunks)
+    {
+        auto object = new VoxelMeshObject(shader, VoxelMeshObject::GetLayout(), this);
+        object->SetLods(chunk.lods);
+        object->SetBox(grid.GetPoint(chunk.begin[0], chunk.begin[1], chunk.begin[2]) - half*grid.GetStep(),
+                       grid.GetPoint(chunk.end[0], chunk.end[1], chunk.end[2]) - half*grid.GetStep());
+        voxelMeshChunks.push_back(object);
+    }
+    m_voxelMesh.chunks.clear();
+}
+
+void SceneView::VoxelMeshBuilt(int generation, QVector<GreedyMesher::Chunk> chunks)
+{
+    if(generation != meshBuilder->GetGeneration())
+        return;
+
+    m_voxelMesh.chunks = chunks;
+    m_voxelMesh.built = true;
+    frameScheduler->RequestProgressive();
+}
+
+void SceneView::ClearVoxelMesh()
+{
+    for(VoxelMeshObject* chunk: voxelMeshChunks)
+        delete chunk;
+    voxelMeshChunks.clear();
+}
+
+void SceneView::RenderVoxelMesh()
+{
+    if(voxelMeshChunks.isEmpty())
+        return;
+
+    const SpaceGrid& grid = m_voxelMesh.grid;
+    const Color modelColor = ISpaceCalculator::GetModelColor();
+    ShaderProgram* shader = voxelMeshChunks.front()->GetShaderProgram();
+    voxelMeshChunks.front()->BindShader();
+    shader->SetUniformValue("worldToView", mvpMatrix);
+    shader->SetUniformValue("gridOrigin", grid.GetOrigin());
+    shader->SetUniformValue("gridStep", grid.GetStep());
+    shader->SetUniformValue("modelColor", QVector4D(modelColor.red, modelColor.green,
+                                                    modelColor.blue, modelColor.alpha));
+
+    // Chunks out of view are skipped, distant ones are drawn coarser
+    const Frustum frustum(mvpMatrix);
+    const float cellSize = grid.GetStep().length();
+    for(VoxelMeshObject* chunk: voxelMeshChunks)
+    {
+        if(!frustum.Intersects(chunk->GetBoxMin(), chunk->GetBoxMax()))
+            continue;
+
+        const float pixels = GetProjectedSize(cellSize, (chunk->GetBoxMin() + chunk->GetBoxMax())/2.f);
+        int lod = 0;
+        while(lod + 1 < VoxelMeshObject::lodsCount && pixels * (2 << lod) <= lodCellPixels)
+            ++lod;
+        chunk->SetLod(lod);
+        chunk->Render();
+    }
+    voxelMeshChunks.front()->ReleaseShader();
 }
 
 void SceneView::UpdateMvpMatrix()
@@ -130,7 +540,8 @@ void SceneView::UpdateMvpMatrix()
 
     mvpMatrix = projMatrix * viewMatrix;
 
-    updateGL();
+    frameScheduler->RequestInteractive();
+    emit CameraChanged();
 }
 
 void SceneView::mousePressEvent(QMouseEvent *event)
@@ -1,27 +1,83 @@
 #ifndef SCENEVIEW_H
 #define SCENEVIEW_H
 
+#include <cfloat>
+#include <QOpenGLTexture>
+
 #include "Base/OpenglWidget.h"
+#include "Base/FrameScheduler.h"
 #include "GridObject.h"
 #include "VoxelObject.h"
+#include "DenseVoxelObject.h"
+#include "VoxelMeshObject.h"
 #include "LinesObject.h"
 #include "WcsObject.h"
+#include "MeshBuilder.h"
 
 
+// Draws on the GUI thread, unlike RayMarchingView: screens and
+// calculators write batches straight into its mapped vertex buffers from
+// GUI slots, and a buffer mapped in one context can't be drawn from
+// another. Moving it to a RenderThread needs those uploads handed over
+// to the render thread first; until then FrameScheduler keeps its frames
+// from starving the GUI
 class SceneView : public OpenglWidget
 {
     Q_OBJECT
 public:
     explicit SceneView(QWidget *parent = nullptr);
+    ~SceneView();
+
+    QVector3D GetCameraPosition() const;
+    // Size in pixels of worldSize seen at the point at
+    float GetProjectedSize(float worldSize, const QVector3D& at) const;
+
+    unsigned GetVoxelsCount() const;
+    unsigned GetVoxelsCapacity() const;
+    unsigned GetDenseVoxelsCount() const;
+    unsigned GetDenseVoxelsCapacity() const;
+
+
+signals:
+    void CameraChanged();
+
+
+private slots:
+    void VoxelMeshBuilt(int generation, QVector<GreedyMesher::Chunk> chunks);
 
 
 public slots:
-    void AddVoxelObject(float x, float y, float z,
-                   float r, float g, float b, float a);
+    void AddVoxels(const QVector<VoxelObject::Voxel>& voxels);
+    void AddVoxels(const VoxelObject::Voxel* voxels, int count);
+    // See VoxelObject::Writer
+    void AddVoxels(int maxCount, const VoxelObject::Writer& writer);
+    // Packed values of consecutive points starting from firstPoint
+    void AddDenseVoxels(qint64 firstPoint, const QVector<quint16>& values);
+    // Values written straight into the buffer, see DenseVoxelObject::MapValues
+    quint16* MapDenseVoxels(qint64 firstPoint, int count);
+    // Which of the values of dense voxels is drawn, nothing is uploaded
+    void SetDenseComponent(int component);
+    void UnmapDenseVoxels();
     void Flush();
     void ClearObjects(bool soft = false);
-    void CreateVoxelObject(int count);
+    // Takes the voxel grid from SpaceManager. Counts are clamped to what
+    // one vertex buffer can hold
+    void CreateVoxelObject(qint64 count);
+    // For views showing every point, positions come from the grid. Each
+    // point holds components values, see SetDenseComponent
+    void CreateDenseVoxelObject(qint64 count, int components = 1);
+    // Replaces the voxels with merged faces of the zone, zones hold every
+    // point of the grid. The mesh follows clipMin of the filter
+    void SetVoxelMesh(const SpaceGrid& grid, const QVector<char>& zones, char zone);
+    // Grid of the voxels added from now on, for coarser levels
+    void SetVoxelGrid(const QVector3D& origin, const QVector3D& step);
     void SetModelCube(const QVector3D& start, QVector3D& end);
+    // Hides voxels below clipMin or with the value range out of
+    // [valueLow, valueHigh] without touching the uploaded data
+    void SetVoxelFilter(const QVector3D& clipMin, float valueLow, float valueHigh);
+    // Rebuilds the color table after the mimage gradient has changed,
+    // drawn values are recolored without an upload
+    void UpdateColorLut();
 
 
 protected:
@@ -38,11 +94,34 @@ protected:
 
 
 private:
+    static constexpr float fov = 45.f;
+    // Mesh chunks use the coarsest level with cells not bigger than this
+    static constexpr float lodCellPixels = 2.f;
+    // Cubes per axis and frames drawn to compare the voxel paths
+    static constexpr int benchmarkSide = 32;
+    static constexpr int benchmarkFrames = 4;
+
+    void SetVoxelUniforms(ShaderProgram* shader, const QVector3D& gridOrigin,
+                          const QVector3D& gridStep);
+    void ChooseVoxelPath();
+    qint64 MeasureVoxels(VoxelObject* voxels);
+    void UpdateVoxelMesh();
+    void ClearVoxelMesh();
+    void RenderVoxelMesh();
+
     QMatrix4x4 viewMatrix;
     QMatrix4x4 projMatrix;
     QMatrix4x4 mvpMatrix;
 
+    static constexpr int colorLutSize = 256;
+
     VoxelObject* voxelObject;
+    DenseVoxelObject* denseVoxelObject;
+    QVector<VoxelMeshObject*> voxelMeshChunks;
+    MeshBuilder* meshBuilder;
+    FrameScheduler* frameScheduler;
+    QOpenGLTexture* colorLut;
+    bool colorLutDirty;
     GridObject* gridObject;
     WcsObject* wcsObject;
 
@@ -54,6 +133,26 @@ private:
         QVector3D pos{0, 0, 0};
     } m_camera;
 
+    struct VoxelFilter
+    {
+        QVector3D clipMin{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        float valueLow = -FLT_MAX;
+        float valueHigh = FLT_MAX;
+    } m_voxelFilter;
+
+    // Source of the mesh, rebuilt by meshBuilder when it or the clipped
+    // cells change. Built chunks wait for the next frame to be uploaded
+    struct VoxelMesh
+    {
+        SpaceGrid grid;
+        QVector<char> zones;
+        char zone = 0;
+        bool dirty = false;
+        int clipMin[3] = {0, 0, 0};
+        bool built = false;
+        QVector<GreedyMesher::Chunk> chunks;
+    } m_voxelMesh;
+
     struct MouseState
     {
         QPoint pos;
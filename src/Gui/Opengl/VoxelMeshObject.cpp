@@ -0,0 +1,52 @@
+#include "VoxelMeshObject.h"
+
+
+VaoLayout VoxelMeshObject::GetLayout()
+{
+    return VaoLayout({VaoLayoutItem(3, GL_UNSIGNED_SHORT)});
+}
+
+VoxelMeshObject::VoxelMeshObject(ShaderProgram *shaderProgram, const VaoLayout &vaoLayout, QObject *parent):
+    OpenglDrawableObject(shaderProgram, vaoLayout, parent)
+{
+    SetPrimitive(GL_TRIANGLES);
+}
+
+void VoxelMeshObject::Render()
+{
+    DrawArrays(_lodFirst[_lod], _lodFirst[_lod + 1] - _lodFirst[_lod]);
+}
+
+void VoxelMeshObject::SetLods(const QVector<Vertex> lods[lodsCount])
+{
+    // Levels follow each other in one buffer
+    _lodFirst[0] = 0;
+    for(int l = 0; l < lodsCount; ++l)
+        _lodFirst[l + 1] = _lodFirst[l] + lods[l].size();
+
+    Destroy();
+    Create(qMax(1u, _lodFirst[lodsCount]));
+    for(int l = 0; l < lodsCount; ++l)
+        AddData(lods[l].constData(), lods[l].size() * sizeof(Vertex));
+}
+
+void VoxelMeshObject::SetLod(int lod)
+{
+    _lod = qBound(0, lod, lodsCount - 1);
+}
+
+void VoxelMeshObject::SetBox(const QVector3D &min, const QVector3D &max)
+{
+    _boxMin = min;
+    _boxMax = max;
+}
+
+const QVector3D &VoxelMeshObject::GetBoxMin() const
+{
+    return _boxMin;
+}
+
+const QVector3D &VoxelMeshObject::GetBoxMax() const
+{
+    return _boxMax;
+}
@@ -0,0 +1,48 @@
+#ifndef VOXELMESHOBJECT_H
+#define VOXELMESHOBJECT_H
+
+#include <QVector>
+#include <QVector3D>
+
+#include "Base/OpenglDrawableObject.h"
+
+
+// Triangles of merged voxel faces of one chunk of the grid, for every
+// level of detail. Vertices are corners of the voxel grid, the shader
+// turns them into world positions
+class VoxelMeshObject: public OpenglDrawableObject
+{
+public:
+    // Level l merges 2^l cells per axis
+    static constexpr int lodsCount = 3;
+
+    // Corner k lies half a step before the center of cell k
+    struct Vertex
+    {
+        quint16 corner[3];
+    };
+
+    static VaoLayout GetLayout();
+
+    VoxelMeshObject(ShaderProgram *shaderProgram, const VaoLayout& vaoLayout, QObject *parent = nullptr);
+
+    void Render() override;
+
+    // Replaces the mesh, the buffer is reallocated to its size
+    void SetLods(const QVector<Vertex> lods[lodsCount]);
+    void SetLod(int lod);
+
+    // World space box of the chunk
+    void SetBox(const QVector3D& min, const QVector3D& max);
+    const QVector3D& GetBoxMin() const;
+    const QVector3D& GetBoxMax() const;
+
+
+private:
+    unsigned _lodFirst[lodsCount + 1] = {};
+    int _lod = 0;
+    QVector3D _boxMin;
+    QVector3D _boxMax;
+};
+
+#endif // VOXELMESHOBJECT_H
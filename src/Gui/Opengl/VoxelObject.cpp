@@ -1,5 +1,42 @@
 #include "VoxelObject.h"
 
+#include <QtMath>
+#include <QVector4D>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+
+// Triangles of a cube around cell (0, 0, 0), w is the face number in
+// the order of the face flags
+static QVector<QVector4D> CubeVertices()
+{
+    QVector<QVector4D> vertices;
+    for(int face = 0; face < 6; ++face)
+    {
+        const int axis = face / 2;
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        const float corners[4][2] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+        for(int id: {0, 1, 2, 0, 2, 3})
+        {
+            QVector4D vertex;
+            vertex[axis] = face % 2 ? 0.5f : -0.5f;
+            vertex[u] = corners[id][0];
+            vertex[v] = corners[id][1];
+            vertex[3] = face;
+            vertices.push_back(vertex);
+        }
+    }
+    return vertices;
+}
+
+
+VaoLayout VoxelObject::GetLayout()
+{
+    return VaoLayout({VaoLayoutItem(4, GL_UNSIGNED_SHORT),
+                      VaoLayoutItem(2, GL_UNSIGNED_SHORT, true)});
+}
+
 VoxelObject::VoxelObject(ShaderProgram *shaderProgram, const VaoLayout& vaoLayout, QObject *parent):
     OpenglDrawableObject(shaderProgram, vaoLayout, parent)
 {
@@ -10,27 +47,178 @@ VoxelObject::~VoxelObject()
 {
 }
 
-void VoxelObject::AddVoxel(float x, float y, float z, float r, float g, float b, float a)
+void VoxelObject::Create(unsigned verticesCount)
+{
+    OpenglDrawableObject::Create(verticesCount);
+    if(!IsCreated())
+        return;
+
+    // The same voxels read once per instance, cube corners per vertex
+    const QVector<QVector4D> cube = CubeVertices();
+    cubeVerticesCount = cube.size();
+
+    instanceVao.create();
+    instanceVao.bind();
+    GetVertexBuffer().bind();
+    SetupAttributes(1);
+
+    cubeVbo.create();
+    cubeVbo.bind();
+    cubeVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    cubeVbo.allocate(cube.constData(), cube.size() * sizeof(QVector4D));
+    QOpenGLFunctions* functions = QOpenGLContext::currentContext()->functions();
+    functions->glEnableVertexAttribArray(cubeLocation);
+    functions->glVertexAttribPointer(cubeLocation, 4, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    instanceVao.release();
+    cubeVbo.release();
+}
+
+void VoxelObject::Render()
+{
+    DrawVoxels(0, GetVerticesCount());
+}
+
+void VoxelObject::SetInstanced(bool instanced)
+{
+    this->instanced = instanced;
+}
+
+bool VoxelObject::IsInstanced() const
+{
+    return instanced;
+}
+
+void VoxelObject::SetGrid(const QVector3D &origin, const QVector3D &step)
+{
+    gridOrigin = origin;
+    gridStep = step;
+}
+
+const QVector3D &VoxelObject::GetGridOrigin() const
+{
+    return gridOrigin;
+}
+
+const QVector3D &VoxelObject::GetGridStep() const
+{
+    return gridStep;
+}
+
+void VoxelObject::AddVoxels(const Voxel *voxels, int count)
+{
+    AddBatch(voxels, count);
+}
+
+void VoxelObject::AddVoxels(const QVector<Voxel> &voxels)
+{
+    AddBatch(voxels.constData(), voxels.size());
+}
+
+void VoxelObject::AddVoxels(int maxCount, const Writer &writer)
+{
+    Voxel* voxels = static_cast<Voxel*>(MapVertices(maxCount));
+    if(!voxels)
+        return;
+
+    const unsigned first = GetVerticesCount();
+    CellBox box;
+    const int count = writer(voxels, maxCount, box);
+    UnmapVertices(qBound(0, count, maxCount));
+    if(GetVerticesCount() != first)
+        AddRange(first, box);
+}
+
+void VoxelObject::Render(const Frustum &frustum)
+{
+    // Neighbouring visible batches are drawn at once
+    unsigned first = 0;
+    unsigned count = 0;
+    for(const Range& range: ranges)
+    {
+        if(!frustum.Intersects(range.min, range.max))
+            continue;
+
+        if(count > 0 && first + count == range.first)
+        {
+            count += range.count;
+        }
+        else
+        {
+            if(count > 0)
+                DrawVoxels(first, count);
+            first = range.first;
+            count = range.count;
+        }
+    }
+    if(count > 0)
+        DrawVoxels(first, count);
+}
+
+void VoxelObject::DrawVoxels(unsigned first, unsigned count)
+{
+    if(!instanced)
+    {
+        DrawArrays(first, count);
+        return;
+    }
+    if(!instanceVao.isCreated())
+        return;
+
+    // No base instance in GL 3.3, the voxel attributes start at first
+    instanceVao.bind();
+    GetVertexBuffer().bind();
+    SetupAttributes(1, first);
+    GetVertexBuffer().release();
+    QOpenGLContext::currentContext()->extraFunctions()->glDrawArraysInstanced(
+                GL_TRIANGLES, 0, cubeVerticesCount, count);
+    instanceVao.release();
+}
+
+void VoxelObject::AddBatch(const Voxel *voxels, int count)
+{
+    const unsigned first = GetVerticesCount();
+    AddData(voxels, count * sizeof(Voxel));
+    if(GetVerticesCount() == first)
+        return;
+
+    CellBox box;
+    for(int i = 0; i < count; ++i)
+    {
+        for(int a = 0; a < 3; ++a)
+        {
+            box.min[a] = qMin<int>(box.min[a], voxels[i].cell[a]);
+            box.max[a] = qMax<int>(box.max[a], voxels[i].cell[a]);
+        }
+    }
+    AddRange(first, box);
+}
+
+void VoxelObject::AddRange(unsigned first, const CellBox &box)
+{
+    ranges.push_back({first, GetVerticesCount() - first,
+                      gridOrigin + (QVector3D(box.min[0], box.min[1], box.min[2]) - QVector3D(0.5f, 0.5f, 0.5f)) * gridStep,
+                      gridOrigin + (QVector3D(box.max[0], box.max[1], box.max[2]) + QVector3D(0.5f, 0.5f, 0.5f)) * gridStep});
+}
+
+unsigned VoxelObject::GetVoxelsCount() const
 {
-    buffer.push_back(x);
-    buffer.push_back(y);
-    buffer.push_back(z);
-    buffer.push_back(r);
-    buffer.push_back(g);
-    buffer.push_back(b);
-    buffer.push_back(a);
-    if(buffer.size() >= flushCount)
-        Flush();
+    return GetVerticesCount();
 }
 
-void VoxelObject::Flush()
+void VoxelObject::Clear()
 {
-    AddData(buffer);
-    buffer.clear();
+    ranges.clear();
+    OpenglDrawableObject::Clear();
 }
 
 void VoxelObject::Destroy()
 {
-    buffer.clear();
+    ranges.clear();
+    if(instanceVao.isCreated())
+    {
+        instanceVao.destroy();
+        cubeVbo.destroy();
+    }
     OpenglDrawableObject::Destroy();
 }
@@ -5,24 +5,136 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLVertexArrayObject>
 #include <QVector>
+#include <QVector3D>
+#include <functional>
 
 #include "Base/OpenglDrawableObject.h"
+#include "Frustum.h"
 
 class VoxelObject: public OpenglDrawableObject
 {
 public:
+    // Values are stored quantized over [-valueLimit, valueLimit]
+    static constexpr float valueLimit = 1.f;
+
+    enum Flags: quint16
+    {
+        // Drawn with the model color instead of the value color
+        Solid = 1,
+        // Faces drawn by the geometry shader, -x, +x, -y, +y, -z, +z
+        NegXFace = 1 << 1,
+        PosXFace = 1 << 2,
+        NegYFace = 1 << 3,
+        PosYFace = 1 << 4,
+        NegZFace = 1 << 5,
+        PosZFace = 1 << 6,
+        AllFaces = NegXFace | PosXFace | NegYFace | PosYFace | NegZFace | PosZFace
+    };
+
+    // Cell of the voxel grid and quantized value range. The world position
+    // is restored in the shader from the grid, the color is looked up by
+    // the value in the color table
+    struct Voxel
+    {
+        quint16 cell[3];
+        quint16 flags;
+        quint16 value[2];
+    };
+
+    // Cells of a batch of voxels lie in [min, max]
+    struct CellBox
+    {
+        int min[3] = {65535, 65535, 65535};
+        int max[3] = {0, 0, 0};
+    };
+
+    // Fills up to count voxels and returns how many were written. The
+    // voxels are write-only buffer memory, so the writer reports their
+    // cells in box instead of having them read back
+    using Writer = std::function<int(Voxel* voxels, int count, CellBox& box)>;
+
+    static VaoLayout GetLayout();
+
+    // Inline so producers' loops can be vectorized
+    static inline quint16 PackValue(float value)
+    {
+        const float normalized = (qBound(-valueLimit, value, valueLimit) + valueLimit) / (2.f*valueLimit);
+        return quint16(normalized * 65535.f + 0.5f);
+    }
+
+    static inline Voxel Pack(int x, int y, int z, float minValue, float maxValue,
+                             quint16 flags = AllFaces)
+    {
+        Voxel voxel;
+        voxel.cell[0] = quint16(qBound(0, x, 65535));
+        voxel.cell[1] = quint16(qBound(0, y, 65535));
+        voxel.cell[2] = quint16(qBound(0, z, 65535));
+        voxel.flags = flags;
+        voxel.value[0] = PackValue(minValue);
+        voxel.value[1] = PackValue(maxValue);
+        return voxel;
+    }
+
     VoxelObject(ShaderProgram *shaderProgram, const VaoLayout& vaoLayout, QObject *parent = nullptr);
     ~VoxelObject();
 
+    using OpenglDrawableObject::Create;
+    void Create(unsigned verticesCount) override;
     void Destroy() override;
+    void Clear() override;
+    void Render() override;
+    // Draws only the added batches with boxes in view
+    void Render(const Frustum& frustum);
+
+    // Cubes drawn as instances of one mesh instead of by the geometry
+    // shader, the shader program has to match
+    void SetInstanced(bool instanced);
+    bool IsInstanced() const;
 
-    void AddVoxel(float x, float y, float z,
-                  float r, float g, float b, float a);
-    void Flush();
+    // World position of cell (0, 0, 0) and the distance between cells
+    void SetGrid(const QVector3D& origin, const QVector3D& step);
+    const QVector3D& GetGridOrigin() const;
+    const QVector3D& GetGridStep() const;
+
+    // Value ranges are tested against the filter uniforms of the shader.
+    // Voxels added at once are culled together
+    void AddVoxels(const Voxel* voxels, int count);
+    void AddVoxels(const QVector<Voxel>& voxels);
+    // The writer fills up to maxCount voxels straight in the vertex buffer
+    void AddVoxels(int maxCount, const Writer& writer);
+
+    unsigned GetVoxelsCount() const;
 
 private:
-    QVector<float> buffer;
-    int flushCount = 4096;
+    // Location of the cube corners in the instanced shader
+    static constexpr int cubeLocation = 2;
+
+    void AddBatch(const Voxel* voxels, int count);
+    // Culling box of the vertices added from first
+    void AddRange(unsigned first, const CellBox& box);
+    void DrawVoxels(unsigned first, unsigned count);
+
+    // Buffer vertices [first, first+count) added at once and the world
+    // box of their cubes
+    struct Range
+    {
+        unsigned first;
+        unsigned count;
+        QVector3D min;
+        QVector3D max;
+    };
+
+    QVector<Range> ranges;
+
+    QVector3D gridOrigin;
+    QVector3D gridStep{1, 1, 1};
+
+    bool instanced = false;
+    QOpenGLVertexArrayObject instanceVao;
+    QOpenGLBuffer cubeVbo;
+    int cubeVerticesCount = 0;
 };
 
+Q_DECLARE_METATYPE(VoxelObject::Voxel)
+
 #endif // VOXELOBJECT_H
@@ -0,0 +1,73 @@
+#include "MeshBuilder.h"
+
+
+MeshBuilder::MeshBuilder(QObject *parent):
+    QObject(parent),
+    _stop(false),
+    _pending(false),
+    _generation(0)
+{
+    qRegisterMetaType<QVector<GreedyMesher::Chunk>>();
+
+    _worker = std::thread(&MeshBuilder::WorkerLoop, this);
+}
+
+MeshBuilder::~MeshBuilder()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stop = true;
+        _pending = false;
+        ++_generation;
+        _notEmpty.wakeAll();
+    }
+    _worker.join();
+}
+
+int MeshBuilder::Build(const Task &task)
+{
+    QMutexLocker locker(&_mutex);
+    _task = task;
+    _pending = true;
+    _notEmpty.wakeOne();
+    return ++_generation;
+}
+
+int MeshBuilder::Cancel()
+{
+    QMutexLocker locker(&_mutex);
+    _pending = false;
+    _task = Task();
+    return ++_generation;
+}
+
+int MeshBuilder::GetGeneration() const
+{
+    return _generation;
+}
+
+void MeshBuilder::WorkerLoop()
+{
+    forever
+    {
+        Task task;
+        int generation;
+        {
+            QMutexLocker locker(&_mutex);
+            while(!_pending && !_stop)
+                _notEmpty.wait(&_mutex);
+            if(_stop)
+                break;
+            task = _task;
+            generation = _generation;
+            _pending = false;
+            _task = Task();
+        }
+
+        // GreedyMesher spreads the chunks over its own threads
+        QVector<GreedyMesher::Chunk> chunks = GreedyMesher::Build(task.grid, task.zones.constData(),
+                                                                  task.zone, task.clipMin);
+        if(_generation == generation)
+            emit Built(generation, chunks);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef MESHBUILDER_H
+#define MESHBUILDER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <atomic>
+#include <thread>
+
+#include "SpaceGrid.h"
+#include "GreedyMesher.h"
+
+
+// Runs GreedyMesher off the GUI thread. Only the latest request is kept:
+// requests arriving while a mesh is built replace each other, and meshes
+// of older generations are dropped
+class MeshBuilder: public QObject
+{
+    Q_OBJECT
+public:
+    struct Task
+    {
+        SpaceGrid grid;
+        QVector<char> zones;
+        char zone = 0;
+        int clipMin[3] = {0, 0, 0};
+    };
+
+    MeshBuilder(QObject* parent = nullptr);
+    ~MeshBuilder();
+
+    // Replaces the pending task, returns its generation
+    int Build(const Task& task);
+    // Drops the pending task and the one being built
+    int Cancel();
+
+    int GetGeneration() const;
+
+
+signals:
+    // Queued to the receiver
+    void Built(int generation, QVector<GreedyMesher::Chunk> chunks);
+
+
+private:
+    void WorkerLoop();
+
+    bool _stop;
+    bool _pending;
+    std::atomic<int> _generation;
+    Task _task;
+
+    QMutex _mutex;
+    QWaitCondition _notEmpty;
+    std::thread _worker;
+};
+
+#endif // MESHBUILDER_H
@@ -3,6 +3,7 @@
 #include "Space/SpaceManager.h"
 #include "Space/Calculators/CommonCalculator.h"
 #include "Space/Calculators/OpenclCalculator.h"
+#include "ZoneSurface.h"
 
 #include <QDebug>
 #include <QFileDialog>
@@ -163,6 +164,7 @@ ModelingScreen::ModelingScreen(QWidget *parent)
                                               Color::fromUint(0,   0,   255, 0),
                                               Color::fromUint(255, 145, 0,   0),
                                               Color::fromUint(214, 0,   255, 0)});
+    _sceneView->UpdateColorLut();
     ISpaceCalculator::SetModelColor(Color::fromUint(255, 255, 255, 0));
 }
 
@@ -175,6 +177,7 @@ ModelingScreen::~ModelingScreen()
 
 void ModelingScreen::Cleanup()
 {
+    _zones.clear();
     _sceneView->ClearObjects();
 }
 
@@ -229,14 +232,8 @@ void ModelingScreen::ImageChanged(QString name)
     else if(name == "Ct")
         _currentImage = 4;
 
-    if(SpaceManager::Self().WasInited() &&
-            SpaceManager::Self().GetMimageBuffer())
-    {
-        auto size = SpaceManager::Self().GetSpaceSize();
-        _sceneView->ClearObjects();
-        _sceneView->CreateVoxelObject(size);
-        ComputeFinished(CalculatorMode::Mimage, 0, size);
-    }
+    // Every component is in the buffer, only the drawn one changes
+    _sceneView->SetDenseComponent(_currentImage);
 }
 
 void ModelingScreen::ZoneChanged(QString name)
@@ -248,13 +245,10 @@ void ModelingScreen::ZoneChanged(QString name)
     else if(name == "Положительная")
         _currentZone = 1;
 
-    if(SpaceManager::Self().WasInited() &&
-            SpaceManager::Self().GetZoneBuffer())
+    if(!_zones.isEmpty() && !IsCalculate())
     {
-        auto size = SpaceManager::Self().GetSpaceSize();
         _sceneView->ClearObjects();
-        _sceneView->CreateVoxelObject(size);
-        ComputeFinished(CalculatorMode::Model, 0, size);
+        _sceneView->SetVoxelMesh(_grid, _zones, _currentZone);
     }
 }
 
@@ -289,6 +283,8 @@ void ModelingScreen::Compute()
                 space.ResetBufferSize(0);
         }
 
+        _grid = SpaceGrid::FromSpace();
+
         QVector3D spaceStart(args[0]->limits.first,
                 args[1]->limits.first,
                 args[2]->limits.first);
@@ -296,7 +292,18 @@ void ModelingScreen::Compute()
                 args[1]->limits.second,
                 args[2]->limits.second);
         _sceneView->SetModelCube(spaceStart, spaceEnd);
-        _sceneView->CreateVoxelObject(space.GetSpaceSize());
+        _zones.clear();
+        if(_imageModeButton->isChecked())
+        {
+            _sceneView->CreateDenseVoxelObject(space.GetSpaceSize(),
+                                               DenseVoxelObject::maxComponents);
+            _sceneView->SetDenseComponent(_currentImage);
+        }
+        else
+        {
+            _zones.resize(space.GetSpaceSize());
+            _sceneView->CreateVoxelObject(space.GetSpaceSize());
+        }
 
         _activeCalculator = dynamic_cast<ISpaceCalculator*>(_computeDevice->isChecked() ?
                                                                 _calculators[CalculatorName::Opencl] :
@@ -318,43 +325,35 @@ void ModelingScreen::ComputeFinished(CalculatorMode mode, int batchStart, int co
 
     if(mode == CalculatorMode::Model)
     {
-        int zone = 0;
-        Vector3f point;
-        Color modelColor;
-        modelColor = ISpaceCalculator::GetModelColor();
+        char* zones = _zones.data() + batchStart;
         for(int i = 0; i < count; ++i)
-        {
-            point = space.GetPointCoords(batchStart+i);
-            zone = space.GetZone(i);
-            if(zone == _currentZone)
-                _sceneView->AddVoxelObject(point.x, point.y, point.z,
-                                           modelColor.red, modelColor.green,
-                                           modelColor.blue, modelColor.alpha);
-        }
+            zones[i] = space.GetZone(i);
+
+        // Visible voxels are shown while computing, the whole model
+        // is replaced by its mesh at the end
+        if(batchStart + count < space.GetSpaceSize())
+            _sceneView->AddVoxels(ZoneSurface::Extract(_grid, batchStart, zones,
+                                                       count, _currentZone));
+        else
+            _sceneView->SetVoxelMesh(_grid, _zones, _currentZone);
     }
     else
     {
-        double value = 0;
-        Vector3f point;
-        for(int i = 0; i < count; ++i)
+        // Every point is shown, values of all components are packed
+        // straight into the buffer so switching them uploads nothing
+        quint16* values = _sceneView->MapDenseVoxels(batchStart, count);
+        for(int i = 0; values && i < count; ++i)
         {
-            point = space.GetPointCoords(batchStart+i);
-            if(_currentImage == 0)
-                value = space.GetMimage(i).Cx;
-            else if(_currentImage == 1)
-                value = space.GetMimage(i).Cy;
-            else if(_currentImage == 2)
-                value = space.GetMimage(i).Cz;
-            else if(_currentImage == 3)
-                value = space.GetMimage(i).Cw;
-            else if(_currentImage == 4)
-                value = space.GetMimage(i).Ct;
-
-            Color color = _activeCalculator->GetMImageColor(value);
-            _sceneView->AddVoxelObject(point.x, point.y, point.z,
-                                       color.red, color.green,
-                                       color.blue, color.alpha);
+            const MimageData& mimage = space.GetMimage(i);
+            quint16* point = values + i*DenseVoxelObject::maxComponents;
+            point[0] = VoxelObject::PackValue(mimage.Cx);
+            point[1] = VoxelObject::PackValue(mimage.Cy);
+            point[2] = VoxelObject::PackValue(mimage.Cz);
+            point[3] = VoxelObject::PackValue(mimage.Cw);
+            point[4] = VoxelObject::PackValue(mimage.Ct);
         }
+        if(values)
+            _sceneView->UnmapDenseVoxels();
     }
     _sceneView->Flush();
     int percent = 100.f*(batchStart+count)/space.GetSpaceSize();
@@ -26,6 +26,7 @@
 #include "SpaceCalculatorThread.h"
 
 #include "ClearableWidget.h"
+#include "SpaceGrid.h"
 
 enum class CalculatorName
 {
@@ -70,6 +71,9 @@ private:
     Parser _parser;
     Program* _program;
     std::vector<ArgumentExpr*> _prevArguments;
+    SpaceGrid _grid;
+    // Zones of every point, meshed once the model is computed
+    QVector<char> _zones;
 
     int _currentZone;
     int _currentImage;
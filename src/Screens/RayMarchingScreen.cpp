@@ -1,12 +1,13 @@
 #include "RayMarchingScreen.h"
 
-#include <fstream>
 #include <sstream>
+#include <cstring>
 using std::stringstream;
 
 
 #include <QtMath>
 #include <QDebug>
+#include <QCoreApplication>
 #include <QFileDialog>
 #include <QMenuBar>
 #include <QHBoxLayout>
@@ -15,6 +16,11 @@ using std::stringstream;
 #include <QLabel>
 #include <QProgressBar>
 #include <QMessageBox>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QFormLayout>
+#include <QSlider>
+#include <QRegularExpression>
 
 
 #include "Space/SpaceManager.h"
@@ -24,13 +30,91 @@ using std::stringstream;
 #include "Gui/BuildSettingsDialog.h"
 
 
+// Constant expressions must stay constant: other const initializers,
+// array sizes and global initializers can't use a uniform
+static bool IsConstantUsed(const QString& code, const QString& topLevel, const QString& name)
+{
+    const QString word = "\\b" + QRegularExpression::escape(name) + "\\b";
+    // Its own declaration is one of the matches
+    int constUses = 0;
+    auto it = QRegularExpression(R"(\bconst\b[^;]*)" + word).globalMatch(code);
+    while(it.hasNext() && constUses < 2)
+    {
+        it.next();
+        ++constUses;
+    }
+    if(constUses > 1)
+        return true;
+    if(QRegularExpression(R"(\[[^\]]*)" + word).match(code).hasMatch())
+        return true;
+
+    const QRegularExpression use(word);
+    int initializers = 0;
+    for(const QStringRef& statement: topLevel.splitRef(';'))
+        if(statement.contains('=') && use.match(statement).hasMatch())
+            ++initializers;
+    return initializers > 1;
+}
+
+// Global float constants of the generated code become uniforms, so they
+// can be changed without building a new shader
+static QString ConstantsToUniforms(const QString& code, QVector<QPair<QByteArray, float>>& constants)
+{
+    static const QRegularExpression constant(
+                R"(\bconst\s+float\s+(\w+)\s*=\s*([-+]?[0-9]*\.?[0-9]+(?:[eE][-+]?[0-9]+)?)\s*;)");
+
+    // Code outside of braces, for the global initializers
+    QString topLevel = code;
+    int braces = 0;
+    for(QChar& c: topLevel)
+    {
+        if(c == '{')
+            ++braces;
+        const bool inside = braces > 0;
+        if(c == '}')
+            --braces;
+        if(inside)
+            c = ' ';
+    }
+
+    QString result;
+    int last = 0;
+    int depth = 0;
+    auto it = constant.globalMatch(code);
+    while(it.hasNext())
+    {
+        const QRegularExpressionMatch match = it.next();
+        const QStringRef before = code.midRef(last, match.capturedStart() - last);
+        depth += before.count('{') - before.count('}');
+        result += before;
+        last = match.capturedEnd();
+
+        // Locals can't be uniforms
+        if(depth > 0 || IsConstantUsed(code, topLevel, match.captured(1)))
+        {
+            result += match.capturedRef(0);
+            continue;
+        }
+        result += "uniform float " + match.captured(1) + ";";
+        constants.push_back({match.captured(1).toUtf8(), match.captured(2).toFloat()});
+    }
+    result += code.midRef(last);
+    return result;
+}
+
+
 RayMarchingScreen::RayMarchingScreen(QWidget *parent)
     : ClearableWidget(parent),
       _sceneView(new RayMarchingView(this)),
       _codeEditor(new CodeEditor(this)),
       _program(nullptr),
+      _buildProgram(nullptr),
       _progressBar(new QProgressBar(_sceneView)),
-      _openclCalculator(new OpenclCalculatorThread(this))
+      _openclCalculator(new OpenclCalculatorThread(this)),
+      _resultWriter(new ResultWriter(this)),
+      _elementSize(sizeof(char)),
+      _remainingPoints(0),
+      _resumed(false)
 {
     QVBoxLayout* toolVLayout = new QVBoxLayout(this);
 
@@ -76,6 +160,8 @@ RayMarchingScreen::RayMarchingScreen(QWidget *parent)
     sizeLayout->addLayout(heightLayout);
 
     modeLayout->addLayout(sizeLayout);
+    _parametersLayout = new QFormLayout();
+    modeLayout->addLayout(_parametersLayout);
     modeLayout->addWidget(_codeEditor);
 
     wrapWidget->setLayout(modeLayout);
@@ -99,6 +185,7 @@ RayMarchingScreen::RayMarchingScreen(QWidget *parent)
 
     _progressBar->setRange(0, 100);
     _progressBar->setValue(0);
+    _progressBar->setMinimumWidth(300);
     _progressBar->hide();
 
     _codeEditor->AddFile("../Core/Examples/NewFuncs/lopatka.txt");
@@ -106,16 +193,49 @@ RayMarchingScreen::RayMarchingScreen(QWidget *parent)
     _codeEditor->AddFile("../Core/Examples/NewFuncs/sphere.txt");
     _oldTabId = _codeEditor->currentIndex();
 
+    // Sent again on the next run
+    connect(_sceneView, &RayMarchingView::ShaderLinked, this, [this](bool linked)
+    {
+        if(!linked)
+            _shaderCode.clear();
+    });
+
     qRegisterMetaType<CalculatorMode>("CalculatorMode");
+    // The calculator waits while a batch is copied out of its buffer
     connect(_openclCalculator , &OpenclCalculatorThread::Computed,
-            this, &RayMarchingScreen::BuildIteration);
+            this, &RayMarchingScreen::BuildIteration, Qt::BlockingQueuedConnection);
+    connect(_openclCalculator, &QThread::finished, this, &RayMarchingScreen::BuildStopped);
+    // A slow disk holds the calculator back instead of the GUI thread,
+    // a failed one stops it. The pyramid is summed up there too, resumed
+    // builds fill it from the finished file
+    _openclCalculator->SetBatchGate([this](CalculatorMode, int batchStart, int count)
+    {
+        if(!_resultWriter->Reserve())
+            return false;
+        if(!_resumed)
+                return true;
+    });
+
+    _resultWriter->SetWrittenCallback([this](qint64 offset, qint64 size)
+    {
+        qint64 start = (offset - qint64(sizeof(ModelMetadata)))/_elementSize;
+        _journal.AddRange(start, start + size/_elementSize);
+    });
 }
 
 RayMarchingScreen::~RayMarchingScreen()
 {
+    // The calculator may be blocked in Reserve or in handing a batch over
+    // to this thread, BuildIteration drops batches once it's interrupted
+    _openclCalculator->requestInterruption();
+    _resultWriter->Abort();
+    while(!_openclCalculator->wait(10))
+        QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
     delete _openclCalculator;
     if(_program)
         delete _program;
+    if(_buildProgram)
+        delete _buildProgram;
 }
 
 void RayMarchingScreen::Cleanup()
@@ -133,37 +253,169 @@ void RayMarchingScreen::RenderHeightChanged(int value)
     _sceneView->SetRenderSize({_widthSpin->value(), value});
 }
 
+void RayMarchingScreen::UpdateParameters(const QVector<QPair<QByteArray, float>> &constants)
+{
+    QLayoutItem* item;
+    while((item = _parametersLayout->takeAt(0)))
+    {
+        delete item->widget();
+        delete item;
+    }
+
+    QMap<QByteArray, float> parameters;
+    for(auto& constant: constants)
+    {
+        const QByteArray name = constant.first;
+        const float value = constant.second;
+        parameters[name] = value;
+
+        // The constant's value is in the middle of the slider
+        const int steps = 1000;
+        const float span = qMax(qAbs(value), 1.f);
+        const float low = value - span;
+
+        QWidget* row = new QWidget(this);
+        QHBoxLayout* rowLayout = new QHBoxLayout(row);
+        rowLayout->setContentsMargins(0, 0, 0, 0);
+        QSlider* slider = new QSlider(Qt::Horizontal, row);
+        slider->setRange(0, steps);
+        slider->setValue(steps/2);
+        QLabel* valueLabel = new QLabel(QString::number(value), row);
+        valueLabel->setMinimumWidth(60);
+        rowLayout->addWidget(slider);
+        rowLayout->addWidget(valueLabel);
+
+        connect(slider, &QSlider::valueChanged, this, [=](int position)
+        {
+            const float newValue = low + 2*span*position/steps;
+            valueLabel->setText(QString::number(newValue));
+            _sceneView->SetParameter(name, newValue);
+        });
+        _parametersLayout->addRow(QString::fromUtf8(name), row);
+    }
+    _sceneView->SetParameters(parameters);
+}
+
 void RayMarchingScreen::BuildIteration(CalculatorMode mode, int batchStart, int count)
 {
+    if(_openclCalculator->isInterruptionRequested())
+        return;
+
     SpaceManager& space = SpaceManager::Self();
+    QByteArray batch;
     if(mode == CalculatorMode::Model)
     {
+        batch = _resultWriter->AcquireBuffer(_elementSize*count);
+        char* zones = batch.data();
         for(int i = 0; i < count; ++i)
         {
-            if(space.GetZone(i) == 0)
+            zones[i] = space.GetZone(i);
+            if(zones[i] == 0)
                 ++_metadata.zeroCount;
-            else if(space.GetZone(i) == 1)
+            else if(zones[i] == 1)
                 ++_metadata.positiveCount;
             else
                 ++_metadata.negativeCount;
         }
-        space.SaveZoneRange(_resultFile, count);
     }
     else
-        space.SaveMimageRange(_resultFile, count);
+    {
+        batch = _resultWriter->AcquireBuffer(_elementSize*count);
+        memcpy(batch.data(), space.GetMimageBuffer(), _elementSize*count);
+    }
+    // Batches already on disk from an interrupted build are not written again
+    if(!_journal.IsDone(batchStart, batchStart+count))
+        _resultWriter->Push(sizeof(ModelMetadata) + _elementSize*batchStart, std::move(batch));
+    else
+    {
+        _resultWriter->ReleaseBuffer(std::move(batch));
+        _resultWriter->Unreserve();
+    }
 
-    float percent = 100.f*(batchStart+count)/space.GetSpaceSize();
+    _remainingPoints -= count;
+    float percent = 100.f*(space.GetSpaceSize() - _remainingPoints)/space.GetSpaceSize();
     _progressBar->setValue(percent);
+    _progressBar->setFormat(QString("%p% | %1 МБ/с | очередь %2/%3")
+                            .arg(_resultWriter->GetBandwidth(), 0, 'f', 1)
+                            .arg(_resultWriter->GetQueueDepth())
+                            .arg(_resultWriter->GetQueueCapacity()));
     qDebug()<<"Written "<<percent<<"% points";
-    if(int(percent) == 100)
+    if(_remainingPoints <= 0)
+        FinishBuild();
+}
+
+void RayMarchingScreen::BuildStopped()
+{
+    if(_remainingPoints <= 0 || !_resultWriter->IsOpened())
+        return;
+
+    // Written ranges stay in the journal, the next build resumes from them
+    qDebug()<<"Build stopped, couldn't write result file";
+    _progressBar->hide();
+    _resultWriter->Abort();
+    _journal.Close(false);
+    _pyramid.Clear();
+}
+
+void RayMarchingScreen::FinishBuild()
+{
+    _progressBar->hide();
+
+    QByteArray header((char*)&_metadata, sizeof(ModelMetadata));
+    bool written = _resultWriter->Finish(header);
+    // Zones and the pyramid of the previous run's points were summed up
+    // by it, not by this one, so both come from the whole file
+    if(written && _resumed)
+        written = RescanResult();
+    if(!written)
+        qDebug()<<"Couldn't write result file";
+    _journal.Close(written);
+    if(written)
+        _pyramid.Save(_resultPath);
+    _pyramid.Clear();
+}
+
+bool RayMarchingScreen::RescanResult()
+{
+    QFile file(_resultPath);
+    if(!file.open(QIODevice::ReadWrite) || !file.seek(sizeof(ModelMetadata)))
+        return false;
+
+    const bool model = _elementSize == sizeof(char);
+    _metadata.zeroCount = 0;
+    _metadata.positiveCount = 0;
+    _metadata.negativeCount = 0;
+    const qint64 blockSize = ResultWriter::writeBlockSize / _elementSize * _elementSize;
+    qint64 point = 0;
+    while(!file.atEnd())
     {
-        _progressBar->hide();
+        const QByteArray block = file.read(blockSize);
+        if(block.isEmpty() || block.size() % _elementSize != 0)
+            return false;
+        const qint64 count = block.size() / _elementSize;
+        if(!model)
+        {
+            _pyramid.AddMimage(point, reinterpret_cast<const MimageData*>(block.constData()), count);
+            point += count;
+            continue;
+        }
 
-        _resultFile.flush();
-        _resultFile.seekp(0);
-        _resultFile.write((char*)&_metadata, sizeof(ModelMetadata));
-        _resultFile.close();
+        _pyramid.AddZones(point, block.constData(), count);
+        point += count;
+        for(char zone: block)
+        {
+            if(zone == 0)
+                ++_metadata.zeroCount;
+            else if(zone == 1)
+                ++_metadata.positiveCount;
+            else
+                ++_metadata.negativeCount;
+        }
     }
+    if(!model)
+        return true;
+    return file.seek(0) &&
+            file.write((char*)&_metadata, sizeof(ModelMetadata)) == sizeof(ModelMetadata);
 }
 
 void RayMarchingScreen::keyPressEvent(QKeyEvent *event)
@@ -201,42 +453,78 @@ void RayMarchingScreen::BuildMimage()
         return;
 
     _parser.SetText(_codeEditor->GetActiveText().toStdString());
-    if(_program)
-        delete _program;
-    _program = _parser.GetProgram();
+    if(_buildProgram)
+        delete _buildProgram;
+    _buildProgram = _parser.GetProgram();
 
     QString resultPath = settingsDialog.fileName();
     if(settingsDialog.computeMode() == "Модель")
     {
         _openclCalculator->SetCalculatorMode(CalculatorMode::Model);
+        _elementSize = sizeof(char);
         resultPath += ".mbin";
     }
     else
     {
         _openclCalculator->SetCalculatorMode(CalculatorMode::Mimage);
+        _elementSize = sizeof(MimageData);
         resultPath += ".ibin";
     }
 
-    _resultFile.open(resultPath.toStdString(), std::ios_base::binary);
-    if(!_resultFile)
-    {
-        qDebug()<<"Couldn't create or open file "<<resultPath;
-        return;
-    }
-
-    _openclCalculator->SetProgram(_program);
+    _openclCalculator->SetProgram(_buildProgram);
 
     SpaceManager& space = SpaceManager::Self();
-    auto args = _program->GetSymbolTable().GetAllArgs();
+    auto args = _buildProgram->GetSymbolTable().GetAllArgs();
     space.InitSpace(args[0]->limits,
                     args[1]->limits,
                     args[2]->limits, settingsDialog.depth());
     space.ResetBufferSize(1024*1024*settingsDialog.memorySize());
     _metadata = space.GetMetadata();
-    _resultFile.write((char*)&_metadata, sizeof(ModelMetadata));
+    _resultPath = resultPath;
+    // The old pyramid no longer describes the file once it's rewritten
+    ResultPyramid::Remove(resultPath);
+    _pyramid.Init(_elementSize == sizeof(MimageData) ?
+                      ResultPyramid::Kind::Mimage : ResultPyramid::Kind::Model,
+                  SpaceGrid::FromSpace());
+
+    QByteArray buildKey;
+    {
+        QDataStream keyStream(&buildKey, QIODevice::WriteOnly);
+        keyStream << _codeEditor->GetActiveText() << _elementSize
+                  << settingsDialog.depth() << qint64(space.GetSpaceSize());
+        for(auto& arg: args)
+            keyStream << double(arg->limits.first) << double(arg->limits.second);
+    }
+    buildKey = QCryptographicHash::hash(buildKey, QCryptographicHash::Sha1);
+    if(!_journal.Open(resultPath, buildKey, space.GetSpaceSize()))
+        qDebug()<<"Couldn't create build journal for "<<resultPath;
+
+    const bool resume = _journal.GetDoneCount() > 0;
+    if(resume)
+        qDebug()<<"Resuming build: "<<_journal.GetDoneCount()<<" of "
+               <<space.GetSpaceSize()<<" points already written";
+    _resumed = resume;
+    _remainingPoints = space.GetSpaceSize() - _journal.GetDoneCount();
+    // Only the missing ranges are computed again
+    _openclCalculator->SetRanges(resume ? _journal.GetMissingRanges() :
+                                          QVector<BuildJournal::Range>());
+
+    qint64 fileSize = sizeof(ModelMetadata) + _elementSize*space.GetSpaceSize();
+    if(!_resultWriter->Open(resultPath, sizeof(ModelMetadata), fileSize,
+                            settingsDialog.preallocate(), !resume))
+    {
+        qDebug()<<"Couldn't create or open file "<<resultPath;
+        _journal.Close(false);
+        return;
+    }
 
     _progressBar->show();
-    _openclCalculator->Run();
+    if(_journal.IsComplete())
+    {
+        FinishBuild();
+        return;
+    }
+    _openclCalculator->start();
 }
 
 void RayMarchingScreen::UpdateScreen()
@@ -245,6 +533,25 @@ void RayMarchingScreen::UpdateScreen()
     if(_program)
         delete _program;
     _program = _parser.GetProgram();
+
+    auto args = _program->GetSymbolTable().GetAllArgs();
+    if(args.size() >= 3)
+    {
+        QVector3D spaceStart(args[0]->limits.first,
+                args[1]->limits.first,
+                args[2]->limits.first);
+        QVector3D spaceEnd(args[0]->limits.second,
+                args[1]->limits.second,
+                args[2]->limits.second);
+        _sceneView->SetModelCube(spaceStart, spaceEnd);
+    }
+    else
+    {
+        // No limits to march within, the previous program's box must go
+        _sceneView->SetModelCube(QVector3D(-1000.f, -1000.f, -1000.f),
+                                 QVector3D(1000.f, 1000.f, 1000.f));
+    }
+
     stringstream result;
     const std::string shaderBegin = R"(#version 330
 out vec4 color;
@@ -253,11 +560,17 @@ uniform vec2 resolution;
 uniform float grad_step;
 uniform vec3 cameraPosition;
 uniform vec2 cameraRotation;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
 
 // ray marching
-const int max_iterations = 2048;
+const int max_iterations = 512;
 const float stop_threshold = 0.001;
 const float clip_far = 1000.0;
+// steps are this part of the distance estimate, it's only first order
+const float step_safety = 0.8;
+const float min_step = 0.001;
+const float max_step = 1.0;
 
 // math
 const float PI = 3.14159265359;
@@ -357,39 +670,55 @@ bool ray_vs_aabb(vec3 o, vec3 dir, vec3 bmin, vec3 bmax, inout vec2 e ) {
     vec3 t = max( a, b );
 
     e.x = max( max( s.x, s.y ), max( s.z, e.x ) );
-    e.y = max( min( t.x, t.y ), max( t.z, e.y ) );
+    e.y = min( min( t.x, t.y ), min( t.z, e.y ) );
 
     return e.x < e.y;
 }
 
+// R-functions aren't distances, f/|grad f| estimates the distance
+// to the surface with d = f(v) already known
+float dist_estimate( vec3 v, float d ) {
+    vec3 df = vec3(
+                dist_field( v + vec3( grad_step, 0.0, 0.0 ) ),
+                dist_field( v + vec3( 0.0, grad_step, 0.0 ) ),
+                dist_field( v + vec3( 0.0, 0.0, grad_step ) )
+                ) - d;
+    return d * grad_step / max( length( df ), 1e-6 );
+}
+
 // ray marching
-bool ray_marching( vec3 o, vec3 dir, inout float depth, inout vec3 n ) {
-    float t = 0.0;
-    float d = 10000.0;
-    float dt = 0.0;
-    for ( int i = 0; i < max_iterations; i++ ) {
-        vec3 v = o + dir * t;
-        d = dist_field( v );
-        if ( d < 0.001 ) {
-            break;
-        }
-        dt = min( abs(d), 0.1 );
+bool ray_marching( vec3 o, vec3 dir, float start, inout float depth, inout vec3 n ) {
+    float t = start;
+    float d = dist_field( o + dir * t );
+    float last_d = d;
+    float dt = min_step;
+    for ( int i = 0; i < max_iterations && d >= stop_threshold; i++ ) {
+        // the slope along the ray over the last step costs no samples,
+        // the gradient is taken only when it doesn't approach the surface
+        float slope = ( last_d - d ) / dt;
+        float estimate = i > 0 && slope > 1e-3 ? d / slope : dist_estimate( o + dir * t, d );
+        // a step grows at most twice the last verified one, so a thin
+        // feature can't be stepped over at full max_step
+        dt = clamp( step_safety * estimate, min_step, min( max_step, 2.0 * dt ) );
         t += dt;
         if ( t > depth ) {
-            break;
+            return false;
         }
+        last_d = d;
+        d = dist_field( o + dir * t );
     }
 
-    if ( d >= 0.001 ) {
+    if ( d >= stop_threshold ) {
         return false;
     }
 
+    // an overshoot lands inside, the surface is between the last samples
     t -= dt;
-    for ( int i = 0; i < 4; i++ ) {
+    for ( int i = 0; i < 8; i++ ) {
         dt *= 0.5;
 
         vec3 v = o + dir * ( t + dt );
-        if ( dist_field( v ) >= 0.001 ) {
+        if ( dist_field( v ) >= stop_threshold ) {
             t += dt;
         }
     }
@@ -397,8 +726,6 @@ bool ray_marching( vec3 o, vec3 dir, inout float depth, inout vec3 n ) {
     depth = t;
     n = normalize( gradient( o + dir * t ) );
     return true;
-
-    return true;
 }
 
 // get ray direction
@@ -438,10 +765,16 @@ void main()
     dir = rot * dir;
     eye = rot * eye;
 
-    // ray marching
-    float depth = clip_far;
+    // ray marching, only between the model box entry and exit
+    vec2 e = vec2( 0.0, clip_far );
+    vec3 pad = vec3( grad_step );
+    if ( !ray_vs_aabb( eye, dir, boxMin - pad, boxMax + pad, e ) ) {
+        color = vec4(0.1, 0.1, 0.2, 1.0);
+        return;
+    }
+    float depth = e.y;
     vec3 n = vec3( 0.0 );
-    if ( !ray_marching( eye, dir, depth, n ) ) {
+    if ( !ray_marching( eye, dir, e.x, depth, n ) ) {
         color = vec4(0.1, 0.1, 0.2, 1.0);
         return;
     }
@@ -455,14 +788,22 @@ void main()
 
 )";
 
-    std::string code = _program->GetShaderCode();
+    QVector<QPair<QByteArray, float>> constants;
+    QString code = ConstantsToUniforms(QString::fromStdString(_program->GetShaderCode()),
+                                       constants);
 
     result << shaderBegin;
-    result << code;
+    result << code.toStdString();
     result << shaderEnd;
 
     auto res = QString::fromStdString(result.str());
     res = res.replace("fabs(", "abs(");
-    _sceneView->ShaderFromSource(res);
-    _sceneView->updateGL();
+    UpdateParameters(constants);
+    // Edited constants alone leave the same shader, nothing is linked.
+    // A shader that failed to link clears it, so it is sent again
+    if(res != _shaderCode)
+    {
+        _shaderCode = res;
+        _sceneView->ShaderFromSource(res);
+    }
 }
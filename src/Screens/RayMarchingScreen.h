@@ -2,7 +2,6 @@
 #define RAY_MARCHING_SCENE_H
 
 #include <QSpinBox>
-#include <fstream>
 
 #include "Gui/ToggleButton.h"
 #include "Gui/Opengl/RayMarchingView.h"
@@ -11,8 +10,12 @@
 #include "Language/Parser.h"
 #include "SpaceCalculatorThread.h"
 #include "ClearableWidget.h"
+#include "Build/ResultWriter.h"
+#include "Build/BuildJournal.h"
+#include "Build/ResultPyramid.h"
 
 class QProgressBar;
+class QFormLayout;
 
 class RayMarchingScreen : public ClearableWidget
 {
@@ -35,23 +38,44 @@ private slots:
     void RenderHeightChanged(int value);
 
     void BuildIteration(CalculatorMode mode, int batchStart, int count);
+    // The calculator stopped before every batch was written
+    void BuildStopped();
 
 
 private:
+    void FinishBuild();
+    // Zone counts of the header and the pyramid, from the whole written
+    // result of a resumed build
+    bool RescanResult();
+
+    // Slider per program constant, bound to the shader uniforms
+    void UpdateParameters(const QVector<QPair<QByteArray, float>>& constants);
+
     RayMarchingView* _sceneView;
     CodeEditor* _codeEditor;
     int _oldTabId;
 
     Parser _parser;
     Program* _program;
+    // Read by the calculator thread while a build runs
+    Program* _buildProgram;
     OpenclCalculatorThread* _openclCalculator;
     ModelMetadata _metadata;
 
     QProgressBar* _progressBar;
     QSpinBox* _heightSpin;
     QSpinBox* _widthSpin;
-
-    std::ofstream _resultFile;
+    QFormLayout* _parametersLayout;
+    // The last shader sent to the view, cleared if it failed to link
+    QString _shaderCode;
+
+    ResultWriter* _resultWriter;
+    BuildJournal _journal;
+    ResultPyramid _pyramid;
+    QString _resultPath;
+    qint64 _elementSize;
+    qint64 _remainingPoints;
+    bool _resumed;
 
     // QWidget interface
 protected:
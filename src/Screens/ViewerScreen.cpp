@@ -4,19 +4,55 @@
 #include <QMenuBar>
 #include <QVBoxLayout>
 #include <QDataStream>
+#include <QTimer>
+#include <QMessageBox>
+#include <cfloat>
+#include <algorithm>
 
 #include "Space/SpaceManager.h"
-#include "Space/Calculators/ISpaceCalculator.h"
+#include "ZoneSurface.h"
+
+
+static constexpr qint64 brickCacheBudget = 1024ll*1024*1024;
+static constexpr float maxCellPixels = 4.f;
+static constexpr int filterDelay = 50;
+
+// Runs on the brick thread, so it only uses its own copy of the grid
+static void SummarizeCoords(const SpaceGrid& grid, qint64 first, qint64 count,
+                            BrickCache::BrickInfo& info)
+{
+    int cellMin[3], cellMax[3];
+    grid.GetCell(first, cellMin[0], cellMin[1], cellMin[2]);
+    std::copy(cellMin, cellMin + 3, cellMax);
+    for(qint64 i = 1; i < count; ++i)
+    {
+        int cell[3];
+        grid.GetCell(first+i, cell[0], cell[1], cell[2]);
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            cellMin[axis] = qMin(cellMin[axis], cell[axis]);
+            cellMax[axis] = qMax(cellMax[axis], cell[axis]);
+        }
+    }
+    info.min = grid.GetPoint(cellMin[0], cellMin[1], cellMin[2]);
+    info.max = grid.GetPoint(cellMax[0], cellMax[1], cellMax[2]);
+}
 
 
 ViewerScreen::ViewerScreen(QWidget *parent):
     ClearableWidget(parent),
+    _mode(Mode::Mimage),
+    _shownLevel(0),
     _view(new SceneView(this)),
     _lowMimageLimiter(new QDoubleSpinBox(this)),
     _highMimageLimiter(new QDoubleSpinBox(this)),
     _xSpaceLimiter(new QDoubleSpinBox(this)),
     _ySpaceLimiter(new QDoubleSpinBox(this)),
-    _zSpaceLimiter(new QDoubleSpinBox(this))
+    _zSpaceLimiter(new QDoubleSpinBox(this)),
+    _bricks(new BrickCache(brickCacheBudget, this)),
+    _builder(new VoxelBuilder(this)),
+    _brickErrorShown(false),
+    _filterTimer(new QTimer(this))
 {
     QVBoxLayout* mainLayout = new QVBoxLayout(this);
 
@@ -61,10 +97,24 @@ ViewerScreen::ViewerScreen(QWidget *parent):
     mainLayout->addSpacing(10);
     mainLayout->addLayout(mimageLimitersLayout);
     mainLayout->addWidget(_view);
+
+    _filterTimer->setSingleShot(true);
+    _filterTimer->setInterval(filterDelay);
+    connect(_filterTimer, &QTimer::timeout, this, &ViewerScreen::ApplyFilter);
+
+    connect(_bricks, &BrickCache::BrickLoaded, this, &ViewerScreen::BrickLoaded);
+    connect(_bricks, &BrickCache::BrickFailed, this, &ViewerScreen::BrickFailed);
+    connect(_builder, &VoxelBuilder::Built, this, &ViewerScreen::BrickBuilt);
+    connect(_builder, &VoxelBuilder::ValuesBuilt, this, &ViewerScreen::BrickValuesBuilt);
+    connect(_view, &SceneView::CameraChanged, this, &ViewerScreen::UpdateBrickQuery);
+    connect(_view, &SceneView::CameraChanged, this, &ViewerScreen::RefineView);
 }
 
 void ViewerScreen::Cleanup()
 {
+    _builder->Restart();
+    _queuedBricks.clear();
+    _drawnBricks.clear();
     _view->ClearObjects();
 }
 
@@ -106,16 +156,34 @@ void ViewerScreen::OpenMimage(const QString &filePath)
 
     ModelMetadata metadata;
     stream.readRawData((char*)&metadata, sizeof(ModelMetadata));
+    file.close();
 
     space.SetMetadata(metadata);
     space.InitFromMetadata();
-    space.ActivateBuffer(SpaceManager::BufferType::MimageBuffer);
-    stream.readRawData((char*)space.GetMimageBuffer(), sizeof(MimageData)*space.GetSpaceSize());
+    LoadPyramid(filePath);
 
-    _view->ClearObjects();
-    _view->CreateVoxelObject(space.GetSpaceSize());
+    // Points are streamed from the file by bricks, the whole
+    // mimage doesn't have to fit into memory
+    _brickErrorShown = false;
+    _bricks->Open(filePath, sizeof(ModelMetadata), sizeof(MimageData), space.GetSpaceSize(),
+                  [grid = _grid](qint64 first, const char* data, qint64 count, BrickCache::BrickInfo& info)
+    {
+        SummarizeCoords(grid, first, count, info);
+        auto mimage = reinterpret_cast<const MimageData*>(data);
+        info.valueMin = info.valueMax = mimage[0].Cx;
+        for(qint64 i = 1; i < count; ++i)
+        {
+            info.valueMin = qMin<double>(info.valueMin, mimage[i].Cx);
+            info.valueMax = qMax<double>(info.valueMax, mimage[i].Cx);
+        }
+    });
 
-    file.close();
+    // Bricks are drawn densely, the sparse object only holds pyramid levels
+    _view->ClearObjects();
+    _view->CreateDenseVoxelObject(qMin<qint64>(space.GetSpaceSize(), _bricks->GetBudgetPoints()));
+    // The gradient may have changed on the modeling screen since
+    _view->UpdateColorLut();
+    _view->CreateVoxelObject(_pyramid.GetLevels().isEmpty() ? 0 : _pyramid.GetLevels().last().GetCellsCount());
 
     _xSpaceLimiter->setRange(metadata.startPoint.x +
                              metadata.pointSize.x,
@@ -144,7 +212,10 @@ void ViewerScreen::OpenMimage(const QString &filePath)
             this, SLOT(YSpaceLimiterChanged(double)));
     connect(_zSpaceLimiter, SIGNAL(valueChanged(double)),
             this, SLOT(ZSpaceLimiterChanged(double)));
+    UpdateBrickQuery();
+    UpdateFilter();
     UpdateMimageView();
+    QTimer::singleShot(0, this, &ViewerScreen::RefineView);
 }
 
 void ViewerScreen::OpenModel(const QString &filePath)
@@ -167,37 +238,27 @@ void ViewerScreen::OpenModel(const QString &filePath)
 
     ModelMetadata metadata;
     stream.readRawData((char*)&metadata, sizeof(ModelMetadata));
+    file.close();
+
     space.SetMetadata(metadata);
     space.InitFromMetadata();
+    LoadPyramid(filePath);
 
-    space.ActivateBuffer(SpaceManager::BufferType::ZoneBuffer);
-    space.ResetBufferSize(metadata.zeroCount);
-
-    _view->ClearObjects();
-    _view->CreateVoxelObject(metadata.zeroCount);
-
-    float voxSize = metadata.pointSize.x;
-    Vector3f point;
-    char value;
-    Color color = ISpaceCalculator::GetModelColor();
-    int spaceSize = space.GetSpaceSize();
-    int zeroCounter = 0;
-    for(int i = 0; i < spaceSize; ++i)
+    _brickErrorShown = false;
+    _bricks->Open(filePath, sizeof(ModelMetadata), sizeof(char), space.GetSpaceSize(),
+                  [grid = _grid](qint64 first, const char* data, qint64 count, BrickCache::BrickInfo& info)
     {
-        stream.readRawData((char*)&value, sizeof(char));
-        if(value == 0)
+        SummarizeCoords(grid, first, count, info);
+        info.valueMin = info.valueMax = data[0];
+        for(qint64 i = 1; i < count; ++i)
         {
-            space.GetZoneBuffer()[zeroCounter] = i;
-            ++zeroCounter;
-            point = space.GetPointCoords(i);
-
-            _view->AddVoxelObject(point.x, point.y, point.z,
-                                  color.red, color.green,
-                                  color.blue, color.alpha);
+            info.valueMin = qMin<double>(info.valueMin, data[i]);
+            info.valueMax = qMax<double>(info.valueMax, data[i]);
         }
-    }
-    _view->Flush();
-    file.close();
+    });
+
+    _view->ClearObjects();
+    _view->CreateVoxelObject(qMin<qint64>(metadata.zeroCount, _bricks->GetBudgetPoints()));
 
     _xSpaceLimiter->setRange(metadata.startPoint.x +
                              metadata.pointSize.x,
@@ -225,100 +286,266 @@ void ViewerScreen::OpenModel(const QString &filePath)
             this, SLOT(YSpaceLimiterChanged(double)));
     connect(_zSpaceLimiter, SIGNAL(valueChanged(double)),
             this, SLOT(ZSpaceLimiterChanged(double)));
+    UpdateBrickQuery();
+    UpdateFilter();
+    UpdateZoneView();
+    QTimer::singleShot(0, this, &ViewerScreen::RefineView);
 }
 
 void ViewerScreen::LowMimageLimiterChanged(double value)
 {
     _highMimageLimiter->setMinimum(value+0.05);
-    UpdateMimageView();
+    UpdateFilter();
 }
 
 void ViewerScreen::HighMimageLimiterChanged(double value)
 {
     _lowMimageLimiter->setMaximum(value-0.05);
-    UpdateMimageView();
+    UpdateFilter();
 }
 
 void ViewerScreen::XSpaceLimiterChanged(double value)
 {
-    if(_mode == Mode::Model)
-        UpdateZoneView();
-    else
-        UpdateMimageView();
+    UpdateFilter();
 }
 
 void ViewerScreen::YSpaceLimiterChanged(double value)
 {
-    if(_mode == Mode::Model)
-        UpdateZoneView();
-    else
-        UpdateMimageView();
+    UpdateFilter();
 }
 
 void ViewerScreen::ZSpaceLimiterChanged(double value)
 {
-    if(_mode == Mode::Model)
-        UpdateZoneView();
+    UpdateFilter();
+}
+
+void ViewerScreen::UpdateBrickQuery()
+{
+    BrickCache::Query query;
+    query.clipMin = QVector3D(_xSpaceLimiter->value(),
+                              _ySpaceLimiter->value(),
+                              _zSpaceLimiter->value());
+    if(_mode == Mode::Mimage)
+    {
+        query.valueLow = _lowMimageLimiter->value();
+        query.valueHigh = _highMimageLimiter->value();
+    }
     else
-        UpdateMimageView();
+    {
+        query.valueLow = 0;
+        query.valueHigh = 0;
+    }
+    query.eye = _view->GetCameraPosition();
+    _bricks->SetQuery(query);
 }
 
-void ViewerScreen::UpdateMimageView()
+void ViewerScreen::UpdateFilter()
 {
+    // Limits are applied by the voxel shader right away: values are
+    // uploaded once per point and compared against uniforms, so dragging
+    // a limiter costs one frame and no pass over the points. The brick
+    // query, pruned by the value range of each brick, follows once the
+    // limiters stop changing and only loads bricks not drawn yet
+    const QVector3D clipMin(_xSpaceLimiter->value(),
+                            _ySpaceLimiter->value(),
+                            _zSpaceLimiter->value());
+    if(_mode == Mode::Mimage)
+        _view->SetVoxelFilter(clipMin, _lowMimageLimiter->value(), _highMimageLimiter->value());
+    else
+        _view->SetVoxelFilter(clipMin, -FLT_MAX, FLT_MAX);
 
-    _view->ClearObjects(true);
-    SpaceManager& space = SpaceManager::Self();
-    float voxSize = space.GetMetadata().pointSize.x;
-    Vector3f point;
-    Color color;
-    int spaceSize = space.GetSpaceSize();
-    MimageData mValue;
-    double limitValue;
-    for(int i = 0; i < spaceSize; ++i)
+    _filterTimer->start();
+}
+
+void ViewerScreen::ApplyFilter()
+{
+    UpdateBrickQuery();
+    if(_shownLevel == _pyramid.GetLevels().size())
+        QueueBricks();
+}
+
+void ViewerScreen::BrickFailed(int id)
+{
+    qDebug()<<"Brick "<<id<<" couldn't be read, its points are not shown";
+    // One message per file is enough
+    if(_brickErrorShown)
+        return;
+    _brickErrorShown = true;
+    QMessageBox::warning(this, "Ошибка", "Часть файла не удалось прочитать, "
+                                         "эти точки не показаны");
+}
+
+void ViewerScreen::BrickLoaded(int id)
+{
+    if(_shownLevel < _pyramid.GetLevels().size())
+        return;
+
+    QueueBrick(id);
+}
+
+void ViewerScreen::BrickBuilt(int generation, int id, QVector<VoxelObject::Voxel> voxels)
+{
+    if(generation != _builder->GetGeneration())
+        return;
+    _queuedBricks.remove(id);
+
+    if(voxels.size() > qint64(_view->GetVoxelsCapacity()) - _view->GetVoxelsCount())
     {
-        mValue = space.GetMimage(i);
-        limitValue = mValue.Cx;
-        if(limitValue <= _highMimageLimiter->value() &&
-                limitValue >= _lowMimageLimiter->value())
-        {
-            point = space.GetPointCoords(i);
-            if(point.x >= _xSpaceLimiter->value() &&
-                    point.y >= _ySpaceLimiter->value() &&
-                    point.z >= _zSpaceLimiter->value())
-            {
-                color = ISpaceCalculator::GetMImageColor(limitValue);
-
-                _view->AddVoxelObject(point.x, point.y, point.z,
-                                      color.red, color.green,
-                                      color.blue, color.alpha);
-            }
-        }
+        // No room left: bricks dropped from the query still take it
+        if(_view->GetVoxelsCount() > 0)
+            Redraw();
+        return;
+    }
+
+    _view->AddVoxels(voxels);
+    _view->Flush();
+    _drawnBricks.insert(id);
+}
+
+void ViewerScreen::BrickValuesBuilt(int generation, int id, QVector<quint16> values)
+{
+    if(generation != _builder->GetGeneration())
+        return;
+    _queuedBricks.remove(id);
+
+    if(values.size() > qint64(_view->GetDenseVoxelsCapacity()) - _view->GetDenseVoxelsCount())
+    {
+        if(_view->GetDenseVoxelsCount() > 0)
+            Redraw();
+        return;
     }
+
+    _view->AddDenseVoxels(_bricks->GetBrickFirstPoint(id), values);
     _view->Flush();
+    _drawnBricks.insert(id);
+}
+
+void ViewerScreen::UpdateMimageView()
+{
+    Redraw();
 }
 
 void ViewerScreen::UpdateZoneView()
 {
+    Redraw();
+}
+
+void ViewerScreen::RefineView()
+{
+    const int target = ChooseLevel();
+    if(target == _shownLevel)
+        return;
+
+    // Coarser levels are shown at once, finer ones one step
+    // per event loop turn so every step gets to the screen
+    _shownLevel = target < _shownLevel ? target : _shownLevel + 1;
+    Redraw();
+    if(_shownLevel != target)
+        QTimer::singleShot(0, this, &ViewerScreen::RefineView);
+}
+
+void ViewerScreen::LoadPyramid(const QString &filePath)
+{
+    _grid = SpaceGrid::FromSpace();
+    const auto kind = _mode == Mode::Mimage ? ResultPyramid::Kind::Mimage :
+                                              ResultPyramid::Kind::Model;
+    if(!_pyramid.Load(filePath) || _pyramid.GetKind() != kind)
+        _pyramid.Clear();
+    _shownLevel = 0;
+}
+
+int ViewerScreen::ChooseLevel() const
+{
+    // The coarsest level whose cells are still small on the screen
+    auto& levels = _pyramid.GetLevels();
+    const QVector3D center = _grid.GetPoint((_grid.GetSize(0)-1)/2.f,
+                                            (_grid.GetSize(1)-1)/2.f,
+                                            (_grid.GetSize(2)-1)/2.f);
+    for(int i = 0; i < levels.size(); ++i)
+    {
+        const float cellSize = _grid.GetStep().x() * (1 << levels[i].level);
+        if(_view->GetProjectedSize(cellSize, center) <= maxCellPixels)
+            return i;
+    }
+    return levels.size();
+}
+
+void ViewerScreen::Redraw()
+{
+    _builder->Restart();
+    _queuedBricks.clear();
+    _drawnBricks.clear();
     _view->ClearObjects(true);
-    SpaceManager& space = SpaceManager::Self();
-    float voxSize = space.GetMetadata().pointSize.x;
-    Vector3f point;
-    int rawId;
-    Color color = ISpaceCalculator::GetModelColor();
-    int bufferSize = space.GetBufferSize();
-    for(int i = 0; i < bufferSize; ++i)
+    if(_shownLevel < _pyramid.GetLevels().size())
     {
-        rawId = space.GetZone(i);
-        point = space.GetPointCoords(rawId);
-        if(point.x >= _xSpaceLimiter->value() &&
-                point.y >= _ySpaceLimiter->value() &&
-                point.z >= _zSpaceLimiter->value())
-        {
-            _view->AddVoxelObject(point.x, point.y, point.z,
-                                  color.red, color.green,
-                                  color.blue, color.alpha);
-        }
+        DrawLevel(_pyramid.GetLevels()[_shownLevel]);
+    }
+    else
+    {
+        _view->SetVoxelGrid(_grid.GetOrigin(), _grid.GetStep());
+        QueueBricks();
     }
     _view->Flush();
 }
 
+void ViewerScreen::QueueBricks()
+{
+    for(int id: _bricks->GetResidentBricks())
+        QueueBrick(id);
+}
+
+void ViewerScreen::QueueBrick(int id)
+{
+    if(_drawnBricks.contains(id) || _queuedBricks.contains(id))
+        return;
+
+    VoxelBuilder::Task task;
+    task.brick = id;
+    task.first = _bricks->GetBrickFirstPoint(id);
+    task.grid = _grid;
+    task.mimage = _mode == Mode::Mimage;
+    task.data = _bricks->GetBrick(id);
+    if(task.data.isEmpty())
+        return;
+
+    _queuedBricks.insert(id);
+    _builder->Add(task);
+}
+
+void ViewerScreen::DrawLevel(const ResultPyramid::Level &level)
+{
+    // Cells of the level form a grid of their own
+    const int side = 1 << level.level;
+    const float offset = (side - 1) / 2.f;
+    const SpaceGrid grid(level.sizes[0], level.sizes[1], level.sizes[2],
+                         _grid.GetPoint(offset, offset, offset), _grid.GetStep() * side);
+    _view->SetVoxelGrid(grid.GetOrigin(), grid.GetStep());
+
+    if(_mode == Mode::Model)
+    {
+        QVector<char> zones(level.GetCellsCount());
+        for(qint64 id = 0; id < zones.size(); ++id)
+            zones[id] = level.cells[id] & ResultPyramid::AnyZero ? 0 : 1;
+        _view->AddVoxels(ZoneSurface::Extract(grid, 0, zones.constData(), zones.size(), 0));
+        return;
+    }
+
+    // Cells are packed in id order straight into the voxel buffer,
+    // colored by the middle of their range
+    auto mimage = reinterpret_cast<const ResultPyramid::MimageCell*>(level.cells.constData());
+    _view->AddVoxels(level.GetCellsCount(), [&](VoxelObject::Voxel* voxels, int,
+                                                 VoxelObject::CellBox& box)
+    {
+        for(int a = 0; a < 3; ++a)
+        {
+            box.min[a] = 0;
+            box.max[a] = level.sizes[a] - 1;
+        }
+        qint64 id = 0;
+        for(int z = 0; z < level.sizes[2]; ++z)
+            for(int y = 0; y < level.sizes[1]; ++y)
+                for(int x = 0; x < level.sizes[0]; ++x, ++id)
+                    voxels[id] = VoxelObject::Pack(x, y, z, mimage[id].min[0], mimage[id].max[0]);
+        return int(id);
+    });
+}
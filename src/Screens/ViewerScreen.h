@@ -3,8 +3,14 @@
 
 #include "ClearableWidget.h"
 #include "Gui/Opengl/SceneView.h"
+#include "Viewer/BrickCache.h"
+#include "Viewer/VoxelBuilder.h"
+#include "Build/ResultPyramid.h"
+#include "SpaceGrid.h"
 
 #include <QDoubleSpinBox>
+#include <QTimer>
+#include <QSet>
 
 class ViewerScreen : public ClearableWidget
 {
@@ -33,11 +39,28 @@ private slots:
     void YSpaceLimiterChanged(double value);
     void ZSpaceLimiterChanged(double value);
 
+    void UpdateBrickQuery();
+    void UpdateFilter();
+    void ApplyFilter();
+    void BrickLoaded(int id);
+    void BrickFailed(int id);
+    void BrickBuilt(int generation, int id, QVector<VoxelObject::Voxel> voxels);
+    void BrickValuesBuilt(int generation, int id, QVector<quint16> values);
     void UpdateMimageView();
     void UpdateZoneView();
+    void RefineView();
 
 private:
+    void LoadPyramid(const QString& filePath);
+    int ChooseLevel() const;
+    void Redraw();
+    void DrawLevel(const ResultPyramid::Level& level);
+    void QueueBricks();
+    void QueueBrick(int id);
+
     Mode _mode;
+    // Index into the pyramid levels, equal to their count for full resolution
+    int _shownLevel;
 
     SceneView* _view;
     QDoubleSpinBox* _lowMimageLimiter;
@@ -46,6 +69,17 @@ private:
     QDoubleSpinBox* _xSpaceLimiter;
     QDoubleSpinBox* _ySpaceLimiter;
     QDoubleSpinBox* _zSpaceLimiter;
+
+    BrickCache* _bricks;
+    VoxelBuilder* _builder;
+    QSet<int> _drawnBricks;
+    QSet<int> _queuedBricks;
+    bool _brickErrorShown;
+    // Coalesces limiter changes before the brick query is updated
+    QTimer* _filterTimer;
+
+    SpaceGrid _grid;
+    ResultPyramid _pyramid;
 };
 
 #endif // VIEWERSCREEN_H
@@ -2,7 +2,16 @@
 #define QSPACECALCULATORWRAPPER_H
 
 #include <QThread>
+#include <QVector>
+#include <QPair>
+#include <functional>
 #include "SpaceCalculators.h"
+#include "Space/SpaceManager.h"
+
+
+// Sees each computed batch on the calculator thread while it is still in
+// the SpaceManager buffer
+using BatchGate = std::function<bool(CalculatorMode mode, int batchStart, int count)>;
 
 
 class CommonCalculatorThread: public QThread, public CommonCalculator
@@ -11,10 +20,22 @@ class CommonCalculatorThread: public QThread, public CommonCalculator
 public:
     CommonCalculatorThread(QObject* parent):
         QThread(parent),
-        CommonCalculator([this](CalculatorMode mode, int batchStart, int end){ emit Computed(mode, batchStart, end); })
+        CommonCalculator([this](CalculatorMode mode, int batchStart, int end)
+        {
+            if(!_batchGate || _batchGate(mode, batchStart, end))
+                emit Computed(mode, batchStart, end);
+        })
     {
 
     }
+
+    // Called on the calculator thread before each batch is handed over,
+    // blocking in it holds the calculation back. Batches it returns false
+    // for are dropped
+    void SetBatchGate(const BatchGate& gate)
+    {
+        _batchGate = gate;
+    }
     
 
 signals:
@@ -26,6 +47,10 @@ protected:
     {
         Run();
     }
+
+
+private:
+    BatchGate _batchGate;
 };
 
 
@@ -36,9 +61,27 @@ class OpenclCalculatorThread: public QThread, public OpenclCalculator
 public:
     OpenclCalculatorThread(QObject* parent):
         QThread(parent),
-        OpenclCalculator([this](CalculatorMode mode, int batchStart, int end){ emit Computed(mode, batchStart, end); })
+        OpenclCalculator([this](CalculatorMode mode, int batchStart, int end)
+        {
+            HandOver(mode, batchStart, end);
+        })
+    {
+
+    }
+
+    // [first, second) point ranges computed by the next start, the whole
+    // space when empty. Resumed builds pass the ranges still missing
+    void SetRanges(const QVector<QPair<qint64, qint64>>& ranges)
     {
+        _ranges = ranges;
+    }
 
+    // Called on the calculator thread before each batch is handed over,
+    // blocking in it holds the calculation back. Returning false stops
+    // the calculation, as does requestInterruption
+    void SetBatchGate(const BatchGate& gate)
+    {
+        _batchGate = gate;
     }
     
 
@@ -49,9 +92,47 @@ void Computed(CalculatorMode mode, int batchStart, int end);
 protected:
     void run() override
     {
-        Run();
+        if(_ranges.isEmpty() && !_batchGate)
+        {
+            Run();
+            return;
+        }
+
+        // Batches of the same size Run uses, only inside the ranges
+        SpaceManager& space = SpaceManager::Self();
+        const qint64 batchSize = qMax<qint64>(1, space.GetBufferSize());
+        const QVector<QPair<qint64, qint64>> ranges = !_ranges.isEmpty() ? _ranges :
+                QVector<QPair<qint64, qint64>>({{0, qint64(space.GetSpaceSize())}});
+        for(auto& range: ranges)
+        {
+            for(qint64 start = range.first; start < range.second; start += batchSize)
+            {
+                if(isInterruptionRequested())
+                    return;
+                const int count = qMin(batchSize, range.second - start);
+                const CalculatorMode mode = GetCalculatorMode();
+                if(mode == CalculatorMode::Model)
+                    CalcModel(start, count);
+                else
+                    CalcMImage(start, count);
+                if(!HandOver(mode, start, count))
+                    return;
+            }
+        }
+    }
+
+
+private:
+    bool HandOver(CalculatorMode mode, int batchStart, int count)
+    {
+        if(_batchGate && (!_batchGate(mode, batchStart, count) || isInterruptionRequested()))
+            return false;
+        emit Computed(mode, batchStart, count);
+        return true;
     }
 
+    BatchGate _batchGate;
+    QVector<QPair<qint64, qint64>> _ranges;
 };
 
 #endif // QSPACECALCULATORWRAPPER_H
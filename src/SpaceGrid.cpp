@@ -0,0 +1,79 @@
+#include "SpaceGrid.h"
+
+#include <QtMath>
+#include "Space/SpaceManager.h"
+
+
+static float Axis(const Vector3f& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+
+SpaceGrid::SpaceGrid():
+    _sizes{1, 1, 1},
+    _strides{1, 1, 1}
+{
+
+}
+
+SpaceGrid::SpaceGrid(int xSize, int ySize, int zSize,
+                     const QVector3D &origin, const QVector3D &step):
+    _sizes{xSize, ySize, zSize},
+    _strides{1, xSize, qint64(xSize)*ySize},
+    _origin(origin),
+    _step(step)
+{
+
+}
+
+SpaceGrid SpaceGrid::FromSpace()
+{
+    SpaceManager& space = SpaceManager::Self();
+    SpaceGrid grid;
+
+    const qint64 count = space.GetSpaceSize();
+    const Vector3f step = space.GetPointSize();
+    const Vector3f start = space.GetPointCoords(0);
+    grid._origin = QVector3D(start.x, start.y, start.z);
+    grid._step = QVector3D(step.x, step.y, step.z);
+
+    auto index = [&](qint64 id, int axis)
+    {
+        return qRound((Axis(space.GetPointCoords(id), axis) - Axis(start, axis)) / Axis(step, axis));
+    };
+
+    // Walk from the fastest axis to the slowest one: the axis that moves
+    // at id == stride is the next one, its size is how long it keeps moving
+    bool used[3] = {false, false, false};
+    qint64 stride = 1;
+    for(int level = 0; level < 3; ++level)
+    {
+        int axis = -1;
+        if(stride < count)
+        {
+            for(int a = 0; a < 3 && axis < 0; ++a)
+                if(!used[a] && index(stride, a) == 1)
+                    axis = a;
+        }
+        if(axis < 0)
+        {
+            for(int a = 0; a < 3 && axis < 0; ++a)
+                if(!used[a])
+                    axis = a;
+        }
+        used[axis] = true;
+
+        int size = 1;
+        if(level == 2)
+            size = qMax<qint64>(1, count / stride);
+        else
+            while(stride*size < count && index(stride*size, axis) == size)
+                ++size;
+
+        grid._sizes[axis] = size;
+        grid._strides[axis] = stride;
+        stride *= size;
+    }
+    return grid;
+}
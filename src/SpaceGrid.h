@@ -0,0 +1,72 @@
+#ifndef SPACEGRID_H
+#define SPACEGRID_H
+
+#include <QtGlobal>
+#include <QVector3D>
+
+
+// Regular grid behind SpaceManager's linear point ids: per-axis point
+// counts and strides, so neighbours and cells can be found without
+// going through coordinates
+class SpaceGrid
+{
+public:
+    SpaceGrid();
+    // Grid with the x axis changing fastest
+    SpaceGrid(int xSize, int ySize, int zSize,
+              const QVector3D& origin, const QVector3D& step);
+
+    // Probes the initialized SpaceManager for the grid layout
+    static SpaceGrid FromSpace();
+
+    inline int GetSize(int axis) const
+    {
+        return _sizes[axis];
+    }
+
+    inline qint64 GetStride(int axis) const
+    {
+        return _strides[axis];
+    }
+
+    inline qint64 GetPointsCount() const
+    {
+        return qint64(_sizes[0]) * _sizes[1] * _sizes[2];
+    }
+
+    inline void GetCell(qint64 id, int& x, int& y, int& z) const
+    {
+        x = (id / _strides[0]) % _sizes[0];
+        y = (id / _strides[1]) % _sizes[1];
+        z = (id / _strides[2]) % _sizes[2];
+    }
+
+    inline qint64 GetId(int x, int y, int z) const
+    {
+        return x*_strides[0] + y*_strides[1] + z*_strides[2];
+    }
+
+    inline QVector3D GetPoint(float x, float y, float z) const
+    {
+        return _origin + QVector3D(x, y, z) * _step;
+    }
+
+    inline const QVector3D& GetOrigin() const
+    {
+        return _origin;
+    }
+
+    inline const QVector3D& GetStep() const
+    {
+        return _step;
+    }
+
+
+private:
+    int _sizes[3];
+    qint64 _strides[3];
+    QVector3D _origin;
+    QVector3D _step;
+};
+
+#endif // SPACEGRID_H
@@ -0,0 +1,349 @@
+#include "BrickCache.h"
+
+#include <QDebug>
+#include <algorithm>
+
+
+BrickCache::BrickCache(qint64 budgetBytes, QObject *parent):
+    QThread(parent),
+    _budgetBytes(budgetBytes),
+    _residentBytes(0),
+    _useCounter(0),
+    _headerSize(0),
+    _elementSize(1),
+    _pointsCount(0),
+    _brickPoints(1),
+    _queryChanged(false),
+    _sorted(false),
+    _brickExtent(0),
+    _stop(false),
+    _knownSinceSort(0)
+{
+
+}
+
+BrickCache::~BrickCache()
+{
+    Close();
+}
+
+bool BrickCache::Open(const QString &filePath, qint64 headerSize, qint64 elementSize,
+                      qint64 pointsCount, const Summarizer &summarizer)
+{
+    Close();
+
+    _file.setFileName(filePath);
+    if(!_file.open(QIODevice::ReadOnly))
+    {
+        qDebug()<<"BrickCache: couldn't open "<<filePath;
+        return false;
+    }
+
+    _headerSize = headerSize;
+    _elementSize = elementSize;
+    _pointsCount = pointsCount;
+    _brickPoints = qMax<qint64>(1, brickBytes / elementSize);
+    _summarizer = summarizer;
+
+    _bricks.clear();
+    _bricks.resize((_pointsCount + _brickPoints - 1) / _brickPoints);
+    _order.clear();
+    _order.reserve(_bricks.size());
+    for(int i = 0; i < _bricks.size(); ++i)
+        _order.push_back(i);
+    _knownSinceSort = 0;
+    _resident.clear();
+    _residentBytes = 0;
+    _queryChanged = false;
+    _sorted = false;
+    _brickExtent = 0;
+    _stop = false;
+
+    start(QThread::LowPriority);
+    return true;
+}
+
+void BrickCache::Close()
+{
+    Stop();
+
+    QMutexLocker locker(&_mutex);
+    _file.close();
+    _resident.clear();
+    _residentBytes = 0;
+    _bricks.clear();
+    _order.clear();
+}
+
+void BrickCache::SetQuery(const Query &query)
+{
+    QMutexLocker locker(&_mutex);
+    _query = query;
+    _queryChanged = true;
+    _wakeUp.wakeAll();
+}
+
+qint64 BrickCache::GetBrickPoints() const
+{
+    return _brickPoints;
+}
+
+qint64 BrickCache::GetBudgetPoints() const
+{
+    return _budgetBytes / _elementSize + _brickPoints;
+}
+
+qint64 BrickCache::GetBrickFirstPoint(int id) const
+{
+    return id * _brickPoints;
+}
+
+QVector<int> BrickCache::GetResidentBricks() const
+{
+    QMutexLocker locker(&_mutex);
+    QVector<int> bricks;
+    for(int id: _order)
+    {
+        auto it = _resident.find(id);
+        if(it != _resident.end() && Intersects(_bricks[id]))
+            bricks.push_back(id);
+    }
+    return bricks;
+}
+
+QByteArray BrickCache::GetBrick(int id)
+{
+    QMutexLocker locker(&_mutex);
+    auto it = _resident.find(id);
+    if(it == _resident.end())
+        return QByteArray();
+    it->lastUse = ++_useCounter;
+    return it->data;
+}
+
+void BrickCache::run()
+{
+    forever
+    {
+        Query query;
+        bool sort;
+        {
+            QMutexLocker locker(&_mutex);
+            if(_stop)
+                break;
+            _queryChanged = false;
+            query = _query;
+            sort = NeedsSort(query);
+        }
+        // Unlocked, the GUI thread keeps reading the previous order
+        if(sort)
+            SortBricks(query);
+
+        int id = -1;
+        {
+            QMutexLocker locker(&_mutex);
+
+            // Load wanted bricks first, then summarize the rest in
+            // the background so the selection gets more precise
+            const QVector<int> wanted = WantedBricks();
+            for(int w: wanted)
+            {
+                if(!_resident.contains(w))
+                {
+                    id = w;
+                    break;
+                }
+            }
+            if(id < 0)
+            {
+                for(int o: _order)
+                {
+                    if(!_bricks[o].known)
+                    {
+                        id = o;
+                        break;
+                    }
+                }
+            }
+
+            if(id < 0)
+            {
+                while(!_stop && !_queryChanged)
+                    _wakeUp.wait(&_mutex);
+                if(_stop)
+                    break;
+                continue;
+            }
+            if(_stop)
+                break;
+        }
+
+        QByteArray data = ReadBrick(id);
+        if(data.isEmpty())
+        {
+            qDebug()<<"BrickCache: read error at brick "<<id;
+            bool failed;
+            {
+                QMutexLocker locker(&_mutex);
+                if(_stop)
+                    break;
+                BrickInfo& info = _bricks[id];
+                failed = ++info.readErrors >= readAttempts;
+                if(failed)
+                {
+                    info.known = true;
+                    info.failed = true;
+                }
+            }
+            if(failed)
+                emit BrickFailed(id);
+            else
+                msleep(100);
+            continue;
+        }
+
+        BrickInfo info;
+        _summarizer(GetBrickFirstPoint(id), data.constData(),
+                    data.size() / _elementSize, info);
+        info.known = true;
+
+        bool loaded = false;
+        {
+            QMutexLocker locker(&_mutex);
+            if(_stop)
+                break;
+            _bricks[id] = info;
+            ++_knownSinceSort;
+
+            const QVector<int> wanted = WantedBricks();
+            if(wanted.contains(id))
+            {
+                EvictFor(data.size(), wanted);
+                _resident.insert(id, {data, ++_useCounter});
+                _residentBytes += data.size();
+                loaded = true;
+            }
+        }
+        if(loaded)
+            emit BrickLoaded(id);
+    }
+}
+
+bool BrickCache::Intersects(const BrickInfo &info) const
+{
+    return Intersects(info, _query);
+}
+
+bool BrickCache::Intersects(const BrickInfo &info, const Query &query)
+{
+    if(info.failed)
+        return false;
+    if(!info.known)
+        return true;
+
+    return info.max.x() >= query.clipMin.x() &&
+            info.max.y() >= query.clipMin.y() &&
+            info.max.z() >= query.clipMin.z() &&
+            info.valueMax >= query.valueLow &&
+            info.valueMin <= query.valueHigh;
+}
+
+bool BrickCache::NeedsSort(const Query &query) const
+{
+    if(!_sorted || _knownSinceSort >= qMax(64, _bricks.size()/16))
+        return true;
+    if(query.clipMin != _sortedQuery.clipMin || query.valueLow != _sortedQuery.valueLow ||
+            query.valueHigh != _sortedQuery.valueHigh)
+        return true;
+    // Moving within a brick hardly changes which ones are nearest
+    return (query.eye - _sortedQuery.eye).length() > _brickExtent / 2;
+}
+
+void BrickCache::SortBricks(const Query &query)
+{
+    // Matching bricks nearest to the camera first, unknown ones
+    // after them in file order, the rest is dropped
+    QVector<QPair<float, int>> known;
+    QVector<int> unknown;
+    float extent = 0;
+    for(int i = 0; i < _bricks.size(); ++i)
+    {
+        const BrickInfo& info = _bricks[i];
+        if(!info.known)
+            unknown.push_back(i);
+        else if(Intersects(info, query))
+        {
+            known.push_back({(query.eye - (info.min + info.max)/2.f).lengthSquared(), i});
+            extent = qMax(extent, (info.max - info.min).length());
+        }
+    }
+    std::sort(known.begin(), known.end());
+
+    QVector<int> order;
+    order.reserve(known.size() + unknown.size());
+    for(auto& k: known)
+        order.push_back(k.second);
+    order.append(unknown);
+
+    QMutexLocker locker(&_mutex);
+    _order.swap(order);
+    _sortedQuery = query;
+    _sorted = true;
+    _brickExtent = extent;
+    _knownSinceSort = 0;
+}
+
+QVector<int> BrickCache::WantedBricks() const
+{
+    QVector<int> wanted;
+    qint64 bytes = 0;
+    for(int id: _order)
+    {
+        if(!Intersects(_bricks[id]))
+            continue;
+        bytes += _brickPoints * _elementSize;
+        if(bytes > _budgetBytes && !wanted.isEmpty())
+            break;
+        wanted.push_back(id);
+    }
+    return wanted;
+}
+
+void BrickCache::EvictFor(qint64 bytes, const QVector<int> &keep)
+{
+    while(_residentBytes + bytes > _budgetBytes && !_resident.isEmpty())
+    {
+        auto victim = _resident.end();
+        for(auto it = _resident.begin(); it != _resident.end(); ++it)
+        {
+            if(keep.contains(it.key()))
+                continue;
+            if(victim == _resident.end() || it->lastUse < victim->lastUse)
+                victim = it;
+        }
+        if(victim == _resident.end())
+            return;
+
+        _residentBytes -= victim->data.size();
+        _resident.erase(victim);
+    }
+}
+
+QByteArray BrickCache::ReadBrick(int id)
+{
+    qint64 first = GetBrickFirstPoint(id);
+    qint64 count = qMin(_brickPoints, _pointsCount - first);
+    if(!_file.seek(_headerSize + first * _elementSize))
+        return QByteArray();
+    return _file.read(count * _elementSize);
+}
+
+void BrickCache::Stop()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stop = true;
+        _wakeUp.wakeAll();
+    }
+    wait();
+}
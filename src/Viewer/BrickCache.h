@@ -0,0 +1,120 @@
+#ifndef BRICKCACHE_H
+#define BRICKCACHE_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QFile>
+#include <QVector3D>
+#include <functional>
+
+
+// Splits a .mbin/.ibin file into bricks of consecutive points and keeps
+// a bounded set of them in memory. Bricks are loaded by a background
+// thread in the order given by the current query. The thread also sorts
+// them, only when the filter changes or the eye moves by half a brick
+class BrickCache: public QThread
+{
+    Q_OBJECT
+public:
+    static constexpr qint64 brickBytes = 4*1024*1024;
+    static constexpr int readAttempts = 3;
+
+    struct BrickInfo
+    {
+        bool known = false;
+        // Unreadable after readAttempts, never wanted again
+        bool failed = false;
+        int readErrors = 0;
+        QVector3D min;
+        QVector3D max;
+        double valueMin = 0;
+        double valueMax = 0;
+    };
+
+    struct Query
+    {
+        QVector3D clipMin;
+        double valueLow = 0;
+        double valueHigh = 0;
+        QVector3D eye;
+    };
+
+    // Fills BrickInfo for count points starting from point first
+    using Summarizer = std::function<void(qint64 first, const char* data,
+                                          qint64 count, BrickInfo& info)>;
+
+    BrickCache(qint64 budgetBytes, QObject* parent = nullptr);
+    ~BrickCache();
+
+    bool Open(const QString& filePath, qint64 headerSize, qint64 elementSize,
+              qint64 pointsCount, const Summarizer& summarizer);
+    void Close();
+
+    void SetQuery(const Query& query);
+
+    qint64 GetBrickPoints() const;
+    qint64 GetBudgetPoints() const;
+    qint64 GetBrickFirstPoint(int id) const;
+
+    // Returns resident bricks matching the query, nearest first
+    QVector<int> GetResidentBricks() const;
+    // Empty if the brick is not resident
+    QByteArray GetBrick(int id);
+
+
+signals:
+    void BrickLoaded(int id);
+    void BrickFailed(int id);
+
+
+protected:
+    void run() override;
+
+
+private:
+    bool Intersects(const BrickInfo& info) const;
+    static bool Intersects(const BrickInfo& info, const Query& query);
+    bool NeedsSort(const Query& query) const;
+    // Loader thread only, _bricks are written by it alone
+    void SortBricks(const Query& query);
+    QVector<int> WantedBricks() const;
+    void EvictFor(qint64 bytes, const QVector<int>& keep);
+    QByteArray ReadBrick(int id);
+    void Stop();
+
+    struct Resident
+    {
+        QByteArray data;
+        quint64 lastUse;
+    };
+
+    qint64 _budgetBytes;
+    qint64 _residentBytes;
+    quint64 _useCounter;
+
+    QFile _file;
+    qint64 _headerSize;
+    qint64 _elementSize;
+    qint64 _pointsCount;
+    qint64 _brickPoints;
+    Summarizer _summarizer;
+
+    Query _query;
+    bool _queryChanged;
+    // Query of the last sort, its largest brick diagonal
+    Query _sortedQuery;
+    bool _sorted;
+    float _brickExtent;
+    bool _stop;
+    QVector<BrickInfo> _bricks;
+    QVector<int> _order;
+    int _knownSinceSort;
+    QHash<int, Resident> _resident;
+
+    mutable QMutex _mutex;
+    QWaitCondition _wakeUp;
+};
+
+#endif // BRICKCACHE_H
@@ -0,0 +1,105 @@
+#include "VoxelBuilder.h"
+
+#include <QThread>
+
+#include "Space/SpaceManager.h"
+#include "ZoneSurface.h"
+
+
+// Points between the cancellation checks
+static constexpr qint64 checkStep = 4096;
+
+VoxelBuilder::VoxelBuilder(QObject *parent):
+    QObject(parent),
+    _stop(false),
+    _generation(0)
+{
+    qRegisterMetaType<QVector<VoxelObject::Voxel>>();
+    qRegisterMetaType<QVector<quint16>>();
+
+    const int workersCount = qMax(1, QThread::idealThreadCount() - 1);
+    for(int i = 0; i < workersCount; ++i)
+        _workers.emplace_back(&VoxelBuilder::WorkerLoop, this);
+}
+
+VoxelBuilder::~VoxelBuilder()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stop = true;
+        _queue.clear();
+        ++_generation;
+        _notEmpty.wakeAll();
+    }
+    for(auto& worker: _workers)
+        worker.join();
+}
+
+int VoxelBuilder::Restart()
+{
+    QMutexLocker locker(&_mutex);
+    _queue.clear();
+    return ++_generation;
+}
+
+void VoxelBuilder::Add(const Task &task)
+{
+    QMutexLocker locker(&_mutex);
+    _queue.enqueue({_generation, task});
+    _notEmpty.wakeOne();
+}
+
+int VoxelBuilder::GetGeneration() const
+{
+    return _generation;
+}
+
+void VoxelBuilder::WorkerLoop()
+{
+    QVector<VoxelObject::Voxel> voxels;
+    QVector<quint16> values;
+    forever
+    {
+        QPair<int, Task> task;
+        {
+            QMutexLocker locker(&_mutex);
+            while(_queue.isEmpty() && !_stop)
+                _notEmpty.wait(&_mutex);
+            if(_stop)
+                break;
+            task = _queue.dequeue();
+        }
+
+        if(task.second.mimage)
+        {
+            if(Build(task.second, task.first, values))
+                emit ValuesBuilt(task.first, task.second.brick, values);
+        }
+        else if(Build(task.second, task.first, voxels))
+        {
+            emit Built(task.first, task.second.brick, voxels);
+        }
+    }
+}
+
+bool VoxelBuilder::Build(const Task &task, int generation, QVector<VoxelObject::Voxel> &voxels) const
+{
+    // Bricks already run in parallel, one thread per brick is enough
+    voxels = ZoneSurface::Extract(task.grid, task.first, task.data.constData(),
+                                  task.data.size(), 0, VoxelObject::Solid, 1);
+    return _generation == generation;
+}
+
+bool VoxelBuilder::Build(const Task &task, int generation, QVector<quint16> &values) const
+{
+    auto mimage = reinterpret_cast<const MimageData*>(task.data.constData());
+    const qint64 count = task.data.size() / sizeof(MimageData);
+    values.resize(count);
+    for(qint64 i = 0; i < count; ++i)
+    {
+        if(i % checkStep == 0 && _generation != generation)
+            return false;
+        values[i] = VoxelObject::PackValue(mimage[i].Cx);
+    }
+    return _generation == generation;
+}
@@ -0,0 +1,66 @@
+#ifndef VOXELBUILDER_H
+#define VOXELBUILDER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QByteArray>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "SpaceGrid.h"
+#include "Gui/Opengl/VoxelObject.h"
+
+
+// Turns viewer bricks into voxel vertex data on worker threads, one brick
+// per worker at a time. Model bricks become voxels of their zero zone,
+// mimage bricks dense packed values. Restarting bumps the generation, so
+// queued and running tasks of older ones are dropped
+class VoxelBuilder: public QObject
+{
+    Q_OBJECT
+public:
+    struct Task
+    {
+        int brick = -1;
+        qint64 first = 0;
+        SpaceGrid grid;
+        bool mimage = false;
+        QByteArray data;
+    };
+
+    VoxelBuilder(QObject* parent = nullptr);
+    ~VoxelBuilder();
+
+    // Cancels everything queued or running, returns the new generation
+    int Restart();
+    void Add(const Task& task);
+
+    int GetGeneration() const;
+
+
+signals:
+    // Queued to the receiver, voxels are empty if the brick has none
+    void Built(int generation, int brick, QVector<VoxelObject::Voxel> voxels);
+    void ValuesBuilt(int generation, int brick, QVector<quint16> values);
+
+
+private:
+    void WorkerLoop();
+    // False if the generation changed while building
+    bool Build(const Task& task, int generation, QVector<VoxelObject::Voxel>& voxels) const;
+    bool Build(const Task& task, int generation, QVector<quint16>& values) const;
+
+    bool _stop;
+    std::atomic<int> _generation;
+
+    mutable QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QQueue<QPair<int, Task>> _queue;
+    std::vector<std::thread> _workers;
+};
+
+#endif // VOXELBUILDER_H
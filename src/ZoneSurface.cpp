@@ -0,0 +1,68 @@
+#include "ZoneSurface.h"
+
+#include <QThread>
+#include <thread>
+#include <vector>
+#include <functional>
+
+
+// Smaller parts aren't worth a thread
+static constexpr qint64 minThreadPoints = 1 << 16;
+
+static void ExtractPart(const SpaceGrid& grid, qint64 first, const char* zones, qint64 count,
+                        char zone, quint16 flags, qint64 begin, qint64 end,
+                        QVector<VoxelObject::Voxel>& voxels)
+{
+    static const quint16 faces[3][2] = {{VoxelObject::NegXFace, VoxelObject::PosXFace},
+                                        {VoxelObject::NegYFace, VoxelObject::PosYFace},
+                                        {VoxelObject::NegZFace, VoxelObject::PosZFace}};
+    int cell[3];
+    for(qint64 i = begin; i < end; ++i)
+    {
+        if(zones[i] != zone)
+            continue;
+
+        grid.GetCell(first + i, cell[0], cell[1], cell[2]);
+        quint16 mask = 0;
+        for(int a = 0; a < 3; ++a)
+        {
+            const qint64 stride = grid.GetStride(a);
+            if(cell[a] == 0 || i - stride < 0 || zones[i - stride] != zone)
+                mask |= faces[a][0];
+            if(cell[a] == grid.GetSize(a) - 1 || i + stride >= count || zones[i + stride] != zone)
+                mask |= faces[a][1];
+        }
+        if(mask != 0)
+            voxels.push_back(VoxelObject::Pack(cell[0], cell[1], cell[2], 0, 0, flags | mask));
+    }
+}
+
+
+QVector<VoxelObject::Voxel> ZoneSurface::Extract(const SpaceGrid &grid, qint64 first,
+                                                 const char *zones, qint64 count,
+                                                 char zone, quint16 flags, int threadsCount)
+{
+    if(threadsCount <= 0)
+        threadsCount = qBound<qint64>(1, count / minThreadPoints, QThread::idealThreadCount());
+
+    QVector<QVector<VoxelObject::Voxel>> parts(threadsCount);
+    std::vector<std::thread> threads;
+    const qint64 partSize = (count + threadsCount - 1) / threadsCount;
+    for(int t = 0; t < threadsCount; ++t)
+    {
+        const qint64 begin = t * partSize;
+        const qint64 end = qMin(count, begin + partSize);
+        if(t == threadsCount - 1)
+            ExtractPart(grid, first, zones, count, zone, flags, begin, end, parts[t]);
+        else
+            threads.emplace_back(ExtractPart, std::cref(grid), first, zones, count, zone,
+                                 flags, begin, end, std::ref(parts[t]));
+    }
+    for(auto& thread: threads)
+        thread.join();
+
+    QVector<VoxelObject::Voxel> voxels = parts[0];
+    for(int t = 1; t < threadsCount; ++t)
+        voxels.append(parts[t]);
+    return voxels;
+}
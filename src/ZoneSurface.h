@@ -0,0 +1,23 @@
+#ifndef ZONESURFACE_H
+#define ZONESURFACE_H
+
+#include <QVector>
+
+#include "SpaceGrid.h"
+#include "Gui/Opengl/VoxelObject.h"
+
+
+// Voxels of a zone that can be seen: points with at least one 6-neighbour
+// outside of the zone, flagged with the faces looking at such neighbours
+class ZoneSurface
+{
+public:
+    // zones hold points [first, first+count) of the grid, neighbours not
+    // in them count as outside. Zero threadsCount picks it by count
+    static QVector<VoxelObject::Voxel> Extract(const SpaceGrid& grid, qint64 first,
+                                               const char* zones, qint64 count,
+                                               char zone, quint16 flags = VoxelObject::Solid,
+                                               int threadsCount = 0);
+};
+
+#endif // ZONESURFACE_H
@@ -7,6 +7,9 @@ using namespace std;
 
 int main(int argc, char *argv[])
 {
+    // One context share group for all views, so shaders and buffers
+    // are created once for the process
+    QApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
     QApplication a(argc, argv);
 
     setlocale(LC_NUMERIC, "C");